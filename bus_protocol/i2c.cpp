@@ -1,25 +1,61 @@
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include "i2c.h"
+#include "i2c_regmap.h"
 
 extern uint32_t _load_start_I2CDriver_cog[];
 extern uint32_t _load_stop_I2CDriver_cog[];
 extern uint8_t binary_i2c_driver_image_dat_start[];
 
-#define pollDelay()    (usleep(30))
+#define I2C_SPIN_POLLS      64          // Polls before BACKOFF starts to waitcnt
+#define I2C_BACKOFF_USEC    2           // waitcnt interval for BACKOFF polling
+#define I2C_YIELD_USEC      30          // usleep interval for YIELD polling
 
-I2C::I2C(int scl, int sda, int freq)
+
+template <typename T>
+static void wireToHost(T* vals, int count, I2C_REG_ORDER order)
+{   // Each value is rebuilt from its own bytes and stored back over them
+    uint8_t *b = (uint8_t *)vals;
+    
+    if (order == I2C_REG_MSB_FIRST)
+        for (int i = 0; i < count; i++, b += sizeof(T))
+            vals[i] = I2CPacker<T, I2C_REG_MSB_FIRST>::unpack(b);
+    else
+        for (int i = 0; i < count; i++, b += sizeof(T))
+            vals[i] = I2CPacker<T, I2C_REG_LSB_FIRST>::unpack(b);
+}
+
+
+template <typename T>
+static void hostToWire(T* vals, int count, I2C_REG_ORDER order)
+{   // Each value is split into wire bytes over its own storage
+    uint8_t *b = (uint8_t *)vals;
+    
+    if (order == I2C_REG_MSB_FIRST)
+        for (int i = 0; i < count; i++, b += sizeof(T))
+            I2CPacker<T, I2C_REG_MSB_FIRST>::pack(b, vals[i]);
+    else
+        for (int i = 0; i < count; i++, b += sizeof(T))
+            I2CPacker<T, I2C_REG_LSB_FIRST>::pack(b, vals[i]);
+}
+
+/** @brief Start a driver cog for the bus on [scl]/[sda].
+ *
+ *  The cog measures its own bit loop when it starts and trims the bit delay
+ *  to suit, so [freq] is met as closely as the loop allows.  getBusFreq() 
+ *  reports the rate actually achieved.
+ *
+ *  @param int scl: SCL pin
+ *  @param int sda: SDA pin
+ *  @param int freq: SCL frequency in Hz, up to I2C_FREQ_MAX (1 MHz)
+ *  @param int stretch: 0 if no device on the bus stretches the clock, which
+ *                      shortens the bit loop enough for 1 MHz
+ */
+I2C::I2C(int scl, int sda, int freq, int stretch)
 {  
-	// only allow speeds up to 400khz for now
-	if (freq > 400000)
-		freq = 400000;
-
-    //I2C_INIT init;
-    m_par.cog            		= -1;
-    m_par.init.scl       		= scl;
-    m_par.init.sda       		= sda;
-    m_par.init.ticks_per_cycle 	= (CLKFREQ / freq)-25;
-    m_par.init.mailbox   		= &m_par.mailbox;
-    m_par.mailbox.cmd    		= I2C_CMD_INIT;
+    if (setup(scl, sda, freq, stretch) != 0)
+        return;
     
     // Start the COG according to the method needed for LMM/XMM memory models
     #if defined(__PROPELLER_XMMC__) || defined(__PROPELLER_XMM__)
@@ -31,36 +67,97 @@ I2C::I2C(int scl, int sda, int freq)
         int *cogbuffer = (int*)_load_start_I2CDriver_cog;
     #endif
     
-    m_par.cog = cognew(cogbuffer, &m_par.init);
+    m_bus->cog = cognew(cogbuffer, &m_bus->init);
+    
+    m_ready = (m_bus->cog >= 0) && waitInit(CLKFREQ >> I2C_INIT_WAIT_SHIFT);
+}
 
-    volatile int n;
-    while (m_par.mailbox.cmd != I2C_CMD_IDLE)
-    {
-        if (n > 127)
-        {
-            m_ready = 0;
-            return;          // Timeout waiting after ~3.8ms
-        }
-        pollDelay();        // Wait 30 uSecs.
-        n++;
-    }
 
-    m_ready = 1;
+/** @brief Add the bus on [scl]/[sda] to a shared multi-bus driver cog.
+ *
+ *  Works like the single bus constructor but no cog of its own is started.
+ *  getCog() returns the shared cog.
+ *
+ *  @param I2CMultiBus& driver: Driver cog to use, must outlive this bus
+ *  @param int scl: SCL pin
+ *  @param int sda: SDA pin
+ *  @param int freq: SCL frequency in Hz, up to I2C_FREQ_MAX (1 MHz)
+ *  @param int stretch: 0 if no device on the bus stretches the clock
+ */
+I2C::I2C(I2CMultiBus& driver, int scl, int sda, int freq, int stretch)
+{
+    if (setup(scl, sda, freq, stretch) != 0 || driver.attach(&m_bus->init) < 0)
+        return;
+    
+    m_multi   = &driver;
+    m_bus->cog = driver.getCog();
+    
+    // The cog may be busy on the other buses, allow ~125ms
+    m_ready = waitInit(CLKFREQ >> 3);
+}
+
+
+/** @brief Make a proxy handle on another cog's bus.
+ *
+ *  Each cog that shares a bus should use its own proxy.  A proxy shares the
+ *  driver cog, command ring and polling jobs of [bus].  It has its own device
+ *  address (openBus()), wait strategy, wait latency figures and contention
+ *  counters.  Producers are serialized with the bus's hardware lock, so a
+ *  bus that could not get a lock cannot be shared and its proxies are never
+ *  ready.  The original [bus] object must outlive its proxies.
+ *
+ *  @param I2C& bus: Bus to share
+ */
+I2C::I2C(I2C& bus)
+{
+    m_bus       = bus.m_bus;
+    m_owner     = 0;
+    m_multi     = 0;
+    m_adr       = 0;
+    m_lastSts   = I2C_OK;
+    m_regBytes  = 0;
+    m_page      = 0;
+    m_ready     = bus.m_ready && m_bus->lock >= 0;
+    
+    setWaitStrategy(bus.m_waitMode);
+    resetWaitLatency();
+    resetContention();
 }
 
 I2C::~I2C()
 {
-    if (m_par.cog >= 0)
+    if (!m_owner || m_bus == 0)
+        return;                         // Proxies leave the bus to its owner
+    
+    if (m_multi)
+    {
+        m_multi->detach(&m_bus->init);
+        m_multi   = 0;
+        m_bus->cog = -1;
+        m_ready   = 0;
+    }
+    
+    if (m_bus->cog >= 0)
     {
-    	cogstop(m_par.cog);
-    	m_par.cog = -1;
+    	cogstop(m_bus->cog);
+    	m_bus->cog = -1;
         m_ready = 0;
     }
+    
+    if (m_bus->lock >= 0)
+    {
+        lockret(m_bus->lock);
+        m_bus->lock = -1;
+    }
+    
+    free(m_bus);
+    m_bus = 0;
 }
 
 int I2C::openBus(uint8_t slaveAdr)
 {
     m_adr = slaveAdr;
+    return 0;
 }
 
 int I2C::closeBus()
@@ -71,7 +168,7 @@ int I2C::closeBus()
 
 int I2C::isReady()
 {
-    if (m_ready & m_adr)
+    if (m_ready && m_adr)
         return 1;
     else
         return 0;
@@ -79,33 +176,114 @@ int I2C::isReady()
 
 int I2C::getCog()
 {
-    return m_par.cog;
+    return m_bus ? m_bus->cog : -1;
 }
 
-int I2C::getStatus()
+/** @brief Get the SCL frequency the driver cog actually runs at.
+ *
+ *  @return int: Frequency in Hz, or 0 if the cog did not start
+ */
+int I2C::getBusFreq()
 {
-    return m_par.mailbox.sts;
+    if (!m_ready)
+        return 0;
+    
+    return CLKFREQ / m_bus->init.ticks_per_cycle;
+}
+
+int I2C::getStatus()
+{   // Status of the last command this handle waited on
+    return m_lastSts;
 }
 
 
 int I2C::devPresent(uint8_t addr)
 {
     if(m_ready)
-    {
-    	WaitForIdle();
-        m_par.mailbox.hdr   = (addr << 1);
-        m_par.mailbox.count = 0;
-        m_par.mailbox.reg_count = 0;
-        m_par.mailbox.cmd   = I2C_CMD_SEND;
-        WaitForIdle();
-
-        return m_par.mailbox.sts == I2C_OK ? 1 : 0;
-    }
+        return wait(submit(I2C_CMD_SEND, addr, -1, 0, 0)) == 0 ? 1 : 0;
     else
         return 0;
 }
 
 
+/** @brief Probe a range of addresses in one driver cog command.
+ *
+ *  The cog sends a bare write header to each address back to back, so the
+ *  whole range costs one round trip instead of one per address.
+ *
+ *  @param uint32_t* map: I2C_SCAN_WORDS words, bit (adr & 31) of word 
+ *                        (adr >> 5) is set for each address that answered
+ *  @param uint8_t first: First address to probe
+ *  @param uint8_t last: Last address to probe (127 max)
+ *  @return int: Number of devices found, or -1 on error
+ */
+int I2C::scan(uint32_t* map, uint8_t first, uint8_t last)
+{
+    if (first > last || last > 127)
+        return -1;
+    
+    if (wait(submit(I2C_CMD_SCAN, 0, first, (uint8_t*)map, last - first + 1)) != 0)
+        return -1;
+    
+    int found = 0;
+    for (int i = 0; i < I2C_SCAN_WORDS; i++)
+        for (uint32_t v = map[i]; v != 0; v &= v - 1)
+            found++;
+    
+    return found;
+}
+
+
+/** @brief Rescan the default address range into the bus's device inventory.
+ *
+ *  The inventory is shared by the bus and all its proxies.  Call this again
+ *  after hot-plugging devices, otherwise it is filled once on first use.
+ *
+ *  @return int: Number of devices found, or -1 on error
+ */
+int I2C::refreshInventory()
+{
+    uint32_t map[I2C_SCAN_WORDS];
+    int found = scan(map);
+    
+    if (found < 0)
+        return -1;
+    
+    memcpy(m_bus->present, map, sizeof(map));
+    m_bus->scanned = 1;
+    return found;
+}
+
+
+/** @brief Copy out the device inventory, scanning first if there is none.
+ *
+ *  @param uint32_t* map: Filled with I2C_SCAN_WORDS words (see scan())
+ *  @return int: 0 on success, -1 on error
+ */
+int I2C::getInventory(uint32_t* map)
+{
+    if (!m_ready || (!m_bus->scanned && refreshInventory() < 0))
+        return -1;
+    
+    memcpy(map, m_bus->present, sizeof(m_bus->present));
+    return 0;
+}
+
+
+/** @brief Look an address up in the device inventory without touching the bus.
+ *
+ *  @param uint8_t addr: 7 bit device address
+ *  @return int: 1 if the device answered the last scan, 0 if not
+ */
+int I2C::isPresent(uint8_t addr)
+{
+    if (!m_ready || addr > 127 || (!m_bus->scanned && refreshInventory() < 0))
+        return 0;
+    
+    return (m_bus->present[addr >> 5] >> (addr & 31)) & 1;
+}
+
+
 int I2C::txByte(uint8_t bt)
 {
     return txByte(-1, bt);
@@ -131,9 +309,7 @@ int I2C::txWord(int32_t reg, uint16_t wd)
 {
     uint8_t  bytes[2];
     
-    bytes[1] = wd;
-    wd >>= 8;
-    bytes[0] = wd;  
+    I2CPacker<uint16_t>::pack(bytes, wd);
 
     if(m_ready)
     	return tx(reg, bytes, 2);
@@ -142,35 +318,72 @@ int I2C::txWord(int32_t reg, uint16_t wd)
 }
 
 
-/*
-int I2C::txLong(uint8_t addr, uint32_t& lg)
-{	// Transmit a single long of data to the bus at the register value
-	// specified.  Transaction is |ST|WRADR|BYTE3|BYTE2|BYTE1|BYTE0|SP|.
-	//
-	//     [addr] - 7 bit I2C address			[lg] - Long of data to transmit
-	//
-    return TXLong(addr, 0, 0, lg);
+int I2C::txLong(uint32_t lg)
+{
+    return txLong(-1, lg);
 }
 
-int I2C::txLong(int32_t reg, uint8_t rcnt, uint32_t lg)
+
+int I2C::txLong(int32_t reg, uint32_t lg)
 {	// Transmit a single long of data to the bus at the register value
 	// specified.  Transaction is |ST|WRADR|REGVAL|BYTE3|BYTE2|BYTE1|BYTE0|SP|.
-	//
-	//     [addr] - 7 bit I2C address    		[reg] - Register value to transmit
-	//	   [rcnt] - 1|2 register byte count 	[lg]  - Word of data to transmit
-	//
+    
     uint8_t  bytes[4];
     
-    for(int i=3; i>=0; i--)
-    {
-        bytes[i] = lg;
-        lg >>= 8;
-    } 
+    I2CPacker<uint32_t>::pack(bytes, lg);
+
     if(m_ready)
-    	return TXBuf(addr, bytes, 4, reg, rcnt);
+    	return tx(reg, bytes, 4);
     else
         return -1;
-}*/
+}
+
+
+/** @brief Write consecutive 16 bit registers in one transaction.
+ *
+ *  The values are put into wire order in [words] itself for the transfer
+ *  and put back before returning, so no copy is made.  The device must 
+ *  auto-increment its register pointer.
+ *
+ *  @param int32_t reg: First register address or -1 for none
+ *  @param int16_t* words: Values to send, reordered while the call runs
+ *  @param int count: Number of words
+ *  @param I2C_REG_ORDER order: Byte order the device expects
+ *  @return int: 0 on success, -1 on error
+ */
+int I2C::txWords(int32_t reg, int16_t* words, int count, I2C_REG_ORDER order)
+{
+    if (count < 0 || count > (I2C_COUNT_MAX >> 1))
+        return -1;
+    
+    hostToWire(words, count, order);
+    int rc = tx(reg, (uint8_t *)words, count << 1);
+    wireToHost(words, count, order);
+    return rc;
+}
+
+
+/** @brief Write consecutive 32 bit registers in one transaction.
+ *
+ *  See txWords().
+ *
+ *  @param int32_t reg: First register address or -1 for none
+ *  @param int32_t* longs: Values to send, reordered while the call runs
+ *  @param int count: Number of longs
+ *  @param I2C_REG_ORDER order: Byte order the device expects
+ *  @return int: 0 on success, -1 on error
+ */
+int I2C::txLongs(int32_t reg, int32_t* longs, int count, I2C_REG_ORDER order)
+{
+    if (count < 0 || count > (I2C_COUNT_MAX >> 2))
+        return -1;
+    
+    hostToWire(longs, count, order);
+    int rc = tx(reg, (uint8_t *)longs, count << 2);
+    wireToHost(longs, count, order);
+    return rc;
+}
+
 
 int I2C::tx(uint8_t *buf, int count)
 {
@@ -180,24 +393,7 @@ int I2C::tx(uint8_t *buf, int count)
 
 int I2C::tx(int32_t reg, uint8_t *buf, int count)
 {
-    int rcnt = getRegByteCount(reg);
-    
-    if(m_ready)
-    {
-    	WaitForIdle();
-        m_par.mailbox.cmd       = I2C_CMD_LOCKED;
-        m_par.mailbox.hdr       = (m_adr << 1);
-        m_par.mailbox.buffer    = buf;
-        m_par.mailbox.count     = count;
-        m_par.mailbox.reg       = reg;
-        m_par.mailbox.reg_count = rcnt;
-        m_par.mailbox.cmd       = I2C_CMD_SEND;
-        WaitForIdle();
-
-        return m_par.mailbox.sts == I2C_OK ? 0 : -1;
-    }
-    else
-        return -1;
+    return wait(txAsync(reg, buf, count));
 }
 
 
@@ -217,9 +413,7 @@ int8_t I2C::rxByte(int32_t reg)
 
     if(m_ready)
     {
-    	rx(reg, &bt, 1);
-
-        if (m_par.mailbox.sts == I2C_OK)
+        if (rx(reg, &bt, 1) == 0)
             return bt;
         else
             return -1;
@@ -242,19 +436,11 @@ int16_t I2C::rxWord(int32_t reg)
  // Transaction is |ST|WRADR|REGVAL|RS|RDADR|BYTE1|BYTE0|SP|.
  
     uint8_t  bytes[2];
-    uint16_t wd = 0;
 
     if(m_ready)
     {
-    	rx(reg, bytes, 2);
-
-        if (m_par.mailbox.sts == I2C_OK)
-        {
-            wd = bytes[0];
-            wd <<= 8;
-            wd |= bytes[1];
-            return wd;
-        }
+        if (rx(reg, bytes, 2) == 0)
+            return I2CPacker<uint16_t>::unpack(bytes);
         else
         	return -1;
 
@@ -264,44 +450,72 @@ int16_t I2C::rxWord(int32_t reg)
 }
 
 
-/*int I2C::RXLong(uint8_t addr)
+int32_t I2C::rxLong()
 {
-    return RXLong(addr, 0, 0);
+    return rxLong(-1);
 }
 
 
-int I2C::RXLong(uint8_t addr, uint16_t reg, uint8_t rcnt=1)
+int32_t I2C::rxLong(int32_t reg)
 {// Read a single long of data from the bus at the register specified.  
- // Register can be 1 or 2 bytes -> [rcnt].  Default is 1 byte. 
  // Transaction is |ST|WRADR|REGVAL|RS|RDADR|BYTE3|BYTE2|BYTE1|BYTE0|SP|.
   
     uint8_t  bytes[4];
-    uint32_t lg = 0;
 
-    if(m_ready)
-    {
-    	RXBuf(addr, bytes, 2, reg, rcnt);
-
-        if (m_par.mailbox.sts == I2C_OK)
-        {
-            lg |= bytes[0];
-            lg <<= 8;
-            lg |= bytes[1];
-            lg <<= 8;
-            lg |= bytes[2];
-            lg <<= 8;
-            lg |= bytes[3];
-
-            return lg;
-        }
-        else
-            return -1;
-    }
+    if(m_ready && rx(reg, bytes, 4) == 0)
+        return I2CPacker<uint32_t>::unpack(bytes);
 
     return -1;
-}*/
+}
+
+
+/** @brief Read consecutive 16 bit registers in one transaction.
+ *
+ *  The cog receives straight into [words], which is then put into host 
+ *  order in place.  Reading a 3 axis sample is one call instead of three
+ *  rxWord() calls.  The device must auto-increment its register pointer.
+ *
+ *  @param int32_t reg: First register address or -1 for none
+ *  @param int16_t* words: Destination for [count] values
+ *  @param int count: Number of words
+ *  @param I2C_REG_ORDER order: Byte order the device sends
+ *  @return int: 0 on success, -1 on error
+ */
+int I2C::rxWords(int32_t reg, int16_t* words, int count, I2C_REG_ORDER order)
+{
+    if (count < 0 || count > (I2C_COUNT_MAX >> 1))
+        return -1;
+    
+    if (rx(reg, (uint8_t *)words, count << 1) != 0)
+        return -1;
+    
+    wireToHost(words, count, order);
+    return 0;
+}
 
 
+/** @brief Read consecutive 32 bit registers in one transaction.
+ *
+ *  See rxWords().
+ *
+ *  @param int32_t reg: First register address or -1 for none
+ *  @param int32_t* longs: Destination for [count] values
+ *  @param int count: Number of longs
+ *  @param I2C_REG_ORDER order: Byte order the device sends
+ *  @return int: 0 on success, -1 on error
+ */
+int I2C::rxLongs(int32_t reg, int32_t* longs, int count, I2C_REG_ORDER order)
+{
+    if (count < 0 || count > (I2C_COUNT_MAX >> 2))
+        return -1;
+    
+    if (rx(reg, (uint8_t *)longs, count << 2) != 0)
+        return -1;
+    
+    wireToHost(longs, count, order);
+    return 0;
+}
+
 int I2C::rx(uint8_t* bytes, int count)
 {
     return rx(-1, bytes, count);
@@ -310,46 +524,732 @@ int I2C::rx(uint8_t* bytes, int count)
 
 int I2C::rx(int32_t reg, uint8_t *buf, int count)
 {
-    int rcnt = getRegByteCount(reg);
+    return wait(rxAsync(reg, buf, count));
+}
+
+
+/** @brief Post a register write to the driver cog and return without waiting.
+ *
+ *  The transaction runs on the driver cog while the caller keeps working.  The
+ *  buffer is read by the cog during the transfer, so it must stay valid and
+ *  unchanged until isDone() reports the handle complete or wait() returns.
+ *
+ *  @param int32_t reg: Register address or -1 for none
+ *  @param uint8_t* buf: Data to send
+ *  @param int count: Number of bytes to send (0-I2C_COUNT_MAX)
+ *  @return int: Transaction handle, or -1 if the bus is not ready
+ */
+int I2C::txAsync(int32_t reg, uint8_t *buf, int count)
+{
+    return submit(I2C_CMD_SEND, m_adr, reg, buf, count);
+}
+
+
+/** @brief Post a register read to the driver cog and return without waiting.
+ *
+ *  The buffer is filled by the driver cog and must stay valid until isDone()
+ *  reports the handle complete or wait() returns.
+ *
+ *  @param int32_t reg: Register address or -1 for none
+ *  @param uint8_t* buf: Destination for received data
+ *  @param int count: Number of bytes to receive (0-I2C_COUNT_MAX)
+ *  @return int: Transaction handle, or -1 if the bus is not ready
+ */
+int I2C::rxAsync(int32_t reg, uint8_t *buf, int count)
+{
+    return submit(I2C_CMD_RECEIVE, m_adr, reg, buf, count);
+}
+
+
+/** @brief Write to a register whose address width the caller already knows.
+ *
+ *  Same as tx() but the width is not worked out from the value, so a 
+ *  register map (see i2c_regmap.h) can hand over the one fixed at compile
+ *  time.  setRegBytes() does not apply.
+ *
+ *  @param uint32_t reg: Register address
+ *  @param int rcnt: Register address bytes to send (0-4)
+ *  @param uint8_t* buf: Data to send
+ *  @param int count: Number of bytes to send (0-I2C_COUNT_MAX)
+ *  @return int: 0 on success, -1 on error
+ */
+int I2C::txReg(uint32_t reg, int rcnt, uint8_t *buf, int count)
+{
+    if (rcnt < 0 || rcnt > 4)
+        return -1;
     
-    if(m_ready)
+    return wait(submit(I2C_CMD_SEND, m_adr, reg, buf, count, 0, rcnt));
+}
+
+
+/** @brief Read from a register whose address width the caller already knows.
+ *
+ *  @param uint32_t reg: Register address
+ *  @param int rcnt: Register address bytes to send (0-4)
+ *  @param uint8_t* buf: Destination for received data
+ *  @param int count: Number of bytes to receive (0-I2C_COUNT_MAX)
+ *  @return int: 0 on success, -1 on error
+ */
+int I2C::rxReg(uint32_t reg, int rcnt, uint8_t *buf, int count)
+{
+    if (rcnt < 0 || rcnt > 4)
+        return -1;
+    
+    return wait(submit(I2C_CMD_RECEIVE, m_adr, reg, buf, count, 0, rcnt));
+}
+
+
+/** @brief Write a list of buffers to a register as one transaction.
+ *
+ *  The segments are sent back to back in a single data phase, straight from
+ *  the caller's memory, so a header and a payload held in different places
+ *  need no staging copy.
+ *
+ *  @param int32_t reg: Register address or -1 for none
+ *  @param I2C_SEGMENT* segs: Buffers to send, in order
+ *  @param int nsegs: Number of segments (1-255)
+ *  @return int: 0 on success, -1 on bus error
+ */
+int I2C::txSeg(int32_t reg, I2C_SEGMENT* segs, int nsegs)
+{
+    return wait(txSegAsync(reg, segs, nsegs));
+}
+
+
+/** @brief Read a register into a list of buffers as one transaction.
+ *
+ *  @param int32_t reg: Register address or -1 for none
+ *  @param I2C_SEGMENT* segs: Buffers to fill, in order
+ *  @param int nsegs: Number of segments (1-255)
+ *  @return int: 0 on success, -1 on bus error
+ */
+int I2C::rxSeg(int32_t reg, I2C_SEGMENT* segs, int nsegs)
+{
+    return wait(rxSegAsync(reg, segs, nsegs));
+}
+
+
+/** @brief Post a scatter/gather write and return without waiting.
+ *
+ *  The segment list and every buffer it points at must stay valid until the
+ *  handle completes.
+ *
+ *  @param int32_t reg: Register address or -1 for none
+ *  @param I2C_SEGMENT* segs: Buffers to send, in order
+ *  @param int nsegs: Number of segments (1-255)
+ *  @return int: Transaction handle, or -1 if the bus is not ready
+ */
+int I2C::txSegAsync(int32_t reg, I2C_SEGMENT* segs, int nsegs)
+{
+    if (nsegs < 1 || nsegs > 255)
+        return -1;
+    
+    return submit(I2C_CMD_SEND, m_adr, reg, (uint8_t*)segs, nsegs, I2C_MBOX_SEGMENTS);
+}
+
+
+/** @brief Post a scatter/gather read and return without waiting.
+ *
+ *  @param int32_t reg: Register address or -1 for none
+ *  @param I2C_SEGMENT* segs: Buffers to fill, in order
+ *  @param int nsegs: Number of segments (1-255)
+ *  @return int: Transaction handle, or -1 if the bus is not ready
+ */
+int I2C::rxSegAsync(int32_t reg, I2C_SEGMENT* segs, int nsegs)
+{
+    if (nsegs < 1 || nsegs > 255)
+        return -1;
+    
+    return submit(I2C_CMD_RECEIVE, m_adr, reg, (uint8_t*)segs, nsegs, I2C_MBOX_SEGMENTS);
+}
+
+
+/** @brief Check if a posted transaction has finished.
+ *
+ *  @param int handle: Handle returned by txAsync()/rxAsync()
+ *  @return int: 1 when the transaction is complete, 0 if still in progress
+ */
+int I2C::isDone(int handle)
+{
+    if (handle < 0)
+        return 1;
+
+    // Compare on 31 bits so the running counter can wrap safely
+    uint32_t ahead = (m_bus->tail - (uint32_t)handle) & 0x7FFFFFFF;
+    return ahead < 0x40000000 ? 1 : 0;
+}
+
+
+/** @brief Block until a posted transaction finishes.
+ *
+ *  The status is kept in the transaction's ring slot, so it can only be read
+ *  until I2C_RING_SIZE further transactions have been posted, by this handle
+ *  or any other on the bus.  A handle waited on later than that fails with
+ *  getStatus() returning I2C_ERR_EXPIRED.
+ *
+ *  @param int handle: Handle returned by txAsync()/rxAsync()
+ *  @return int: 0 on success, -1 on bus error, expired or invalid handle
+ */
+int I2C::wait(int handle)
+{
+    if (handle < 0)
+        return -1;
+
+    volatile I2C_MAILBOX *slot = &m_bus->ring[(handle - 1) & (I2C_RING_SIZE - 1)];
+    int waited = 0;
+    int polls  = 0;
+
+    while (!isDone(handle))
     {
-    	WaitForIdle();
-        m_par.mailbox.cmd       = I2C_CMD_LOCKED;
-        m_par.mailbox.hdr       = (m_adr << 1);
-        m_par.mailbox.buffer    = buf;
-        m_par.mailbox.count     = count;
-        m_par.mailbox.reg       = reg;
-        m_par.mailbox.reg_count = rcnt;
-        m_par.mailbox.cmd       = I2C_CMD_RECEIVE;
-        WaitForIdle();
-
-        return m_par.mailbox.sts == I2C_OK ? 0 : -1;
+        pollDelay(polls++);
+        waited = 1;
     }
-    else
+
+    uint32_t now   = CNT;
+    uint32_t sts   = slot->sts;
+    uint32_t stamp = slot->stamp;
+
+    // A producer claims the slot by writing seq before anything else, and the
+    // cog only rewrites sts after that, so an unchanged seq vouches for both
+    if (slot->seq != (uint32_t)handle)
+    {
+        m_lastSts = I2C_ERR_EXPIRED;
+        return -1;
+    }
+
+    if (waited)
+    {   // Ticks between the cog retiring the slot and us noticing it
+        uint32_t late = now - stamp;
+        m_latency.last   = late;
+        m_latency.total += late;
+        m_latency.count++;
+        if (late > m_latency.max)
+            m_latency.max = late;
+    }
+
+    m_lastSts = sts;
+    return m_lastSts == I2C_OK ? 0 : -1;
+}
+
+
+
+
+
+/** @brief Run a list of transactions on the driver cog as a single command.
+ *
+ *  All entries are executed back to back for the cost of one ring slot, so a
+ *  sweep of several sensors needs one handshake instead of one per register.
+ *  Each entry's sts field holds its own result when the batch completes.
+ *
+ *  @param I2C_BATCH_ENTRY* entries: Array of transactions (see setBatchEntry)
+ *  @param int count: Number of entries (1-255)
+ *  @return int: 0 when every entry succeeded, -1 otherwise
+ */
+int I2C::batch(I2C_BATCH_ENTRY* entries, int count)
+{
+    return wait(batchAsync(entries, count));
+}
+
+
+/** @brief Post a batch of transactions and return without waiting.
+ *
+ *  The entry array and all of its buffers must stay valid until the handle
+ *  completes.
+ *
+ *  @param I2C_BATCH_ENTRY* entries: Array of transactions (see setBatchEntry)
+ *  @param int count: Number of entries (1-255)
+ *  @return int: Transaction handle, or -1 if the bus is not ready
+ */
+int I2C::batchAsync(I2C_BATCH_ENTRY* entries, int count)
+{
+    if (count < 1 || count > 255)
+        return -1;
+    
+    return submit(I2C_CMD_BATCH, 0, -1, (uint8_t*)entries, count);
+}
+
+
+/** @brief Fill in one batch entry.
+ *
+ *  @param I2C_BATCH_ENTRY& e: Entry to fill
+ *  @param uint8_t adr: 7 bit device address
+ *  @param int32_t reg: Register address or -1 for none
+ *  @param uint8_t* buf: Source or destination buffer
+ *  @param int count: Number of bytes to transfer
+ *  @param int read: 1 to read from the device, 0 to write to it
+ */
+void I2C::setBatchEntry(I2C_BATCH_ENTRY& e, uint8_t adr, int32_t reg, 
+                        uint8_t* buf, int count, int read)
+{
+    e.hdr       = (adr << 1) | (read ? I2C_READ : I2C_WRITE);
+    e.reg       = reg;
+    e.reg_count = getRegByteCount(reg);
+    e.count     = count;
+    e.buffer    = buf;
+    e.sts       = I2C_OK;
+}
+
+
+
+/** @brief Select how the calling cog waits on the driver cog.
+ *
+ *  I2C_WAIT_SPIN polls the hub continuously and wakes within a few hub cycles
+ *  of completion.  I2C_WAIT_BACKOFF spins for a short while and then polls on
+ *  a waitcnt interval, trading a little latency for less hub traffic during
+ *  long transfers.  I2C_WAIT_YIELD sleeps between polls so other threads on
+ *  the calling cog can run.  getWaitLatency() reports what each one costs.
+ *
+ *  @param I2C_WAIT mode: Wait strategy to use
+ */
+void I2C::setWaitStrategy(I2C_WAIT mode)
+{
+    m_waitMode = mode;
+}
+
+
+/** @brief Get the wake-up latency measured by wait().
+ *
+ *  Latency is the time in clock ticks from the driver cog retiring a slot to
+ *  wait() noticing it.  Calls that find the transaction already done are not
+ *  counted.
+ *
+ *  @param I2C_WAIT_LATENCY* lat: Filled with the last, maximum, total and count
+ */
+void I2C::getWaitLatency(I2C_WAIT_LATENCY* lat)
+{
+    *lat = m_latency;
+}
+
+
+/** @brief Clear the wake-up latency measurements.
+ */
+void I2C::resetWaitLatency()
+{
+    m_latency.last  = 0;
+    m_latency.max   = 0;
+    m_latency.total = 0;
+    m_latency.count = 0;
+}
+
+
+
+/** @brief Register a register read for the driver cog to run on its own.
+ *
+ *  The cog reads [count] bytes from the register every [period_us] while it
+ *  has no queued commands and keeps the latest result in hub RAM.  readPoll()
+ *  then returns the newest sample with no bus traffic or handshake.
+ *
+ *  @param uint8_t adr: 7 bit device address
+ *  @param int32_t reg: Register address or -1 for none
+ *  @param int count: Bytes to read each period (1-I2C_POLL_BYTES)
+ *  @param uint32_t period_us: Time between reads in microseconds, at most
+ *                             2^31 clock ticks (26.8s at 80MHz)
+ *  @return int: Job number, or -1 if no job is free or arguments are invalid
+ */
+int I2C::addPoll(uint8_t adr, int32_t reg, int count, uint32_t period_us)
+{
+    return startPoll(adr, reg, count, period_us, 0, 0);
+}
+
+
+/** @brief Register a register read for the driver cog to fire on a data ready pin.
+ *
+ *  The cog watches [pin] between commands and reads [count] bytes from the 
+ *  register each time the pin becomes active, so a sample is in hub RAM one
+ *  transaction after the sensor has it and no read is wasted on old data.
+ *  readPoll() returns it as for timed jobs; its sequence number changes once
+ *  per sample.  If the pin stays active for [stuck_us], say after a failed
+ *  read left a latched DRDY set, the read is repeated to clear it.
+ *
+ *  @param uint8_t adr: 7 bit device address
+ *  @param int32_t reg: Register address or -1 for none
+ *  @param int count: Bytes to read each time (1-I2C_POLL_BYTES)
+ *  @param int pin: Data ready input pin
+ *  @param int activeHigh: 1 if the pin is high while data is ready, 0 if low
+ *  @param uint32_t stuck_us: Time the pin may stay active before reading again,
+ *                            at most 2^31 clock ticks (26.8s at 80MHz)
+ *  @return int: Job number, or -1 if no job is free or arguments are invalid
+ */
+int I2C::addDrdyPoll(uint8_t adr, int32_t reg, int count, int pin, int activeHigh,
+                     uint32_t stuck_us)
+{
+    if (pin < 0 || pin > 31)
+        return -1;
+    
+    return startPoll(adr, reg, count, stuck_us, 1u << pin, activeHigh ? 1u << pin : 0);
+}
+
+
+/** @brief Stop a polling job and free it for reuse.
+ *
+ *  @param int job: Job number returned by addPoll()
+ */
+void I2C::removePoll(int job)
+{
+    if (m_ready && job >= 0 && job < I2C_POLL_MAX)
+        m_bus->poll[job].period = 0;
+}
+
+
+/** @brief Copy out the latest result of a polling job.
+ *
+ *  @param int job: Job number returned by addPoll()
+ *  @param uint8_t* buf: Destination for the job's [count] bytes
+ *  @return int: Sequence number of the sample copied, 0 if no sample yet or
+ *               -1 for an invalid job.  A changed number means a new sample.
+ */
+int I2C::readPoll(int job, uint8_t* buf)
+{
+    if (!m_ready || job < 0 || job >= I2C_POLL_MAX)
         return -1;
+    
+    I2C_POLL_JOB *pj = &m_bus->poll[job];
+    uint32_t seq;
+    
+    // Retry if the cog finished another read while we were copying
+    do
+    {
+        seq = pj->seq;
+        memcpy(buf, pj->data[seq & 1], pj->count);
+    } while (seq != pj->seq);
+    
+    return (int)(seq & 0x7FFFFFFF);
 }
 
 
+/** @brief Get the bus status of a polling job's latest read.
+ *
+ *  @param int job: Job number returned by addPoll()
+ *  @return int: I2C_RESULT of the latest read, or -1 for an invalid job
+ */
+int I2C::getPollStatus(int job)
+{
+    if (!m_ready || job < 0 || job >= I2C_POLL_MAX)
+        return -1;
+    
+    return m_bus->poll[job].sts;
+}
+
 
 
+/** @brief Copy out the driver cog's instrumentation counters.
+ *
+ *  Only available when i2c.cpp and the driver cog are both built with 
+ *  I2C_DRIVER_STATS.  The cog keeps updating the block while it is copied,
+ *  so counters from a busy bus may be one transaction apart.
+ *
+ *  @param I2C_STATS* stats: Filled with the current counters
+ *  @return int: 0 on success, -1 if stats are compiled out or the bus is not ready
+ */
+int I2C::getStats(I2C_STATS* stats)
+{
+#ifdef I2C_DRIVER_STATS
+    if (!m_ready)
+        return -1;
+    
+    memcpy(stats, (const void*)&m_bus->stats, sizeof(I2C_STATS));
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+/** @brief Clear the driver cog's instrumentation counters.
+ *
+ *  The reset is queued like any other command so it lands between 
+ *  transactions and never tears a counter update.
+ *
+ *  @return int: 0 on success, -1 if stats are compiled out or the bus is not ready
+ */
+int I2C::resetStats()
+{
+#ifdef I2C_DRIVER_STATS
+    return wait(submit(I2C_CMD_STATS_RESET, 0, -1, 0, 0));
+#else
+    return -1;
+#endif
+}
+
+
+
+/** @brief Get the time this handle has spent waiting on other producers.
+ *
+ *  Counts are kept per handle, so give each cog its own proxy (see the 
+ *  I2C(I2C&) constructor) to see which cog loses time to which.
+ *
+ *  @param I2C_CONTENTION* con: Filled with the lock and ring counters
+ */
+void I2C::getContention(I2C_CONTENTION* con)
+{
+    *con = m_contention;
+}
+
+
+/** @brief Clear this handle's contention counters.
+ */
+void I2C::resetContention()
+{
+    memset(&m_contention, 0, sizeof(m_contention));
+}
+
+
+/** @brief Fix the number of register address bytes sent.
+ *
+ *  By default the width follows the register value, which suits register
+ *  mapped parts.  Memories such as 24xx EEPROMs always expect the full 
+ *  address width, even for low addresses.  With a width set, every register
+ *  value other than -1 is sent as an unsigned address of that many bytes.
+ *
+ *  @param int bytes: Address bytes (1-4), or 0 to follow the register value
+ */
+void I2C::setRegBytes(int bytes)
+{
+    if (bytes >= 0 && bytes <= 4)
+        m_regBytes = bytes;
+}
+
+
+/** @brief Have the driver cog split writes at device page boundaries.
+ *
+ *  Writes that cross a multiple of [bytes] in register (memory) address 
+ *  space are broken up there, and the cog ACK polls the device through
+ *  each page's write cycle.  A multi-kilobyte EEPROM write is then still a 
+ *  single command.  Reads are never split.
+ *
+ *  @param int bytes: Page size, a power of 2 up to 32768, or 0 for none
+ *  @return int: 0 on success, -1 if [bytes] is not a valid page size
+ */
+int I2C::setPageSize(int bytes)
+{
+    if (bytes < 0 || bytes > 32768 || (bytes & (bytes - 1)) != 0)
+        return -1;
+    
+    m_page = bytes;
+    return 0;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////
 // Private Members
 //
 
+int I2C::setup(int scl, int sda, int freq, int stretch)
+{   // Allocate and fill in the hub side of the bus ahead of handing it to a 
+    // driver cog.  The PAR_S lives on the heap so proxies can share it.
+	if (freq > I2C_FREQ_MAX)
+		freq = I2C_FREQ_MAX;
+	if (freq <= 0)
+		freq = 100000;
+
+    m_owner                     = 1;
+    m_multi                     = 0;
+    m_ready                     = 0;
+    m_adr                       = 0;
+    m_lastSts                   = I2C_OK;
+    m_regBytes                  = 0;
+    m_page                      = 0;
+    
+    setWaitStrategy(I2C_WAIT_SPIN);
+    resetWaitLatency();
+    resetContention();
+    
+    m_bus = (PAR_S *) malloc(sizeof(PAR_S));
+    if (m_bus == 0)
+        return -1;
+    
+    m_bus->cog            		= -1;
+    m_bus->init.scl       		= scl;
+    m_bus->init.sda       		= sda;
+    m_bus->init.ticks_per_cycle 	= CLKFREQ / freq;
+    m_bus->init.flags     		= stretch ? 0 : I2C_INIT_NO_STRETCH;
+    m_bus->init.half_cycle      = 0;
+    m_bus->init.mailbox   		= m_bus->ring;
+    m_bus->init.tail      		= &m_bus->tail;
+    m_bus->init.poll      		= m_bus->poll;
+    m_bus->init.single    		= &m_bus->single;
+#ifdef I2C_DRIVER_STATS
+    m_bus->init.stats     		= &m_bus->stats;
+#endif
+    m_bus->head           		= 0;
+    m_bus->tail           		= 0;
+    m_bus->lock           		= locknew();  // -1 leaves a single producer only
+    
+    for (int i = 0; i < I2C_RING_SIZE; i++)
+    {
+        m_bus->ring[i].cmd       = I2C_CMD_IDLE;
+        m_bus->ring[i].seq       = 0;       // Handles start at 1
+    }
+    m_bus->ring[0].cmd    		= I2C_CMD_INIT;
+    
+    for (int i = 0; i < I2C_POLL_MAX; i++)
+        m_bus->poll[i].period    = 0;
+    m_bus->scanned        		= 0;
+    
+    return 0;
+}
+
+
+int I2C::waitInit(uint32_t timeout)
+{   // Wait for the cog to bring the bus up, 1 when ready or 0 on timeout
+    uint32_t start = CNT;
+    while (m_bus->ring[0].cmd != I2C_CMD_IDLE)
+    {
+        if (CNT - start > timeout)
+            return 0;
+    }
+
+    return 1;
+}
+
+
+void I2C::pollDelay(int polls)
+{   // One idle step of a wait loop according to the wait strategy
+    switch (m_waitMode)
+    {
+        case I2C_WAIT_BACKOFF:
+            if (polls >= I2C_SPIN_POLLS)
+                waitcnt(CNT + (CLKFREQ / 1000000) * I2C_BACKOFF_USEC);
+            break;
+
+        case I2C_WAIT_YIELD:
+            usleep(I2C_YIELD_USEC);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
 void I2C::WaitForIdle()
+{   // Wait for the cog to drain every posted command
+    int polls = 0;
+	while (m_bus->tail != m_bus->head)
+		pollDelay(polls++);
+}
+
+
+int I2C::startPoll(uint8_t adr, int32_t reg, int count, uint32_t period_us, 
+                   uint32_t mask, uint32_t state)
 {
-	while (m_par.mailbox.cmd != I2C_CMD_IDLE)
-		usleep(30);
+    if (!m_ready || count < 1 || count > I2C_POLL_BYTES || period_us == 0)
+        return -1;
+    
+    // The cog compares CNT against the next read as a signed difference, so
+    // the period must not pass 2^31 ticks (about 26s at 80MHz)
+    uint64_t ticks = (uint64_t)(CLKFREQ / 1000000) * period_us;
+    if (ticks == 0 || ticks > 0x80000000ull)
+        return -1;
+    
+    // Another cog may be claiming a job at the same time
+    lockBus();
+    
+    for (int i = 0; i < I2C_POLL_MAX; i++)
+    {
+        I2C_POLL_JOB *job = &m_bus->poll[i];
+        
+        if (job->period != 0)
+            continue;
+        
+        job->hdr        = (adr << 1);
+        job->reg        = reg;
+        job->reg_count  = getRegByteCount(reg);
+        job->count      = count;
+        job->drdy_mask  = mask;
+        job->drdy_state = state;
+        job->armed      = 1;
+        job->sts        = I2C_OK;
+        job->seq        = 0;
+        job->next       = CNT;
+        job->period     = (uint32_t)ticks;  // Cog sees the job from here
+        unlockBus();
+        return i;
+    }
+    
+    unlockBus();
+    return -1;
+}
+
+
+int I2C::submit(I2C_CMD cmd, uint8_t adr, int32_t reg, uint8_t *buf, int count, uint8_t flags,
+                int rcnt)
+{
+    if (rcnt < 0)
+        rcnt = getRegByteCount(reg);
+
+    if (!m_ready || count < 0 || count > I2C_COUNT_MAX)
+        return -1;
+
+    lockBus();
+
+    // Wait for a free slot if the cog is a full ring behind
+    if (m_bus->head - m_bus->tail >= I2C_RING_SIZE)
+    {
+        uint32_t start = CNT;
+        int polls = 0;
+        while (m_bus->head - m_bus->tail >= I2C_RING_SIZE)
+            pollDelay(polls++);
+        
+        m_contention.ring_full++;
+        m_contention.ring_ticks += CNT - start;
+    }
+
+    int handle = (int)((m_bus->head + 1) & 0x7FFFFFFF);
+    
+    volatile I2C_MAILBOX *slot = &m_bus->ring[m_bus->head & (I2C_RING_SIZE - 1)];
+    slot->seq       = handle;           // Earlier waiters on the slot see it is gone
+    slot->hdr       = (adr << 1);
+    slot->buffer    = buf;
+    slot->count     = count;
+    slot->flags     = flags;
+    slot->page      = (cmd == I2C_CMD_SEND && count > 0) ? m_page : 0;  // Probes fail fast
+    slot->reg       = reg;
+    slot->reg_count = rcnt;
+    slot->cmd       = cmd;              // Cog picks the slot up from here
+    m_bus->head++;
+
+    unlockBus();
+    return handle;
+}
+
+
+void I2C::lockBus()
+{   // Take the producer lock, timing how long other cogs kept us waiting
+    if (m_bus->lock < 0)
+        return;
+    
+    m_contention.acquires++;
+    if (lockset(m_bus->lock) == 0)
+        return;                         // Uncontended
+    
+    uint32_t start = CNT;
+    while (lockset(m_bus->lock))
+        ;
+    
+    uint32_t ticks = CNT - start;
+    m_contention.contended++;
+    m_contention.lock_ticks += ticks;
+    if (ticks > m_contention.max_lock_ticks)
+        m_contention.max_lock_ticks = ticks;
+}
+
+
+void I2C::unlockBus()
+{
+    if (m_bus->lock >= 0)
+        lockclr(m_bus->lock);
 }
 
 
 int I2C::getRegByteCount(int32_t reg)
 {
-    if (reg < 0)
+    if (reg == -1 || (reg < 0 && m_regBytes == 0))
         return 0;
     
+    if (m_regBytes)
+        return m_regBytes;
+    
     if (reg > 0xFFFFFF)
         return 4;
     if (reg > 0xFFFF)
@@ -3,15 +3,61 @@
 
 #include "i_i2c.h"
 #include "i2c_driver.h"
+#include "i2c_multi.h"
+
+// Byte order of a register's value on the wire
+enum I2C_REG_ORDER
+{
+    I2C_REG_MSB_FIRST,      // Big endian, most I2C parts
+    I2C_REG_LSB_FIRST       // Little endian
+};
+
+// Ways for the calling cog to wait on the driver cog
+enum I2C_WAIT
+{
+    I2C_WAIT_SPIN,          // Poll the hub continuously
+    I2C_WAIT_BACKOFF,       // Spin briefly, then poll on a waitcnt interval
+    I2C_WAIT_YIELD          // usleep between polls to let other threads run
+};
+
+// Wake-up latency of wait() in clock ticks
+typedef struct I2C_WAIT_LATENCY
+{
+    uint32_t last;          // Latency of the last wait
+    uint32_t max;           // Worst latency seen
+    uint32_t total;         // Sum of all latencies, total/count = average
+    uint32_t count;         // Number of waits measured
+} I2C_WAIT_LATENCY;
+
+// Time a handle spent waiting on other producers, in clock ticks
+typedef struct I2C_CONTENTION
+{
+    uint32_t acquires;      // Times the producer lock was taken
+    uint32_t contended;     // Times it was held by another cog
+    uint32_t lock_ticks;    // Total time spent waiting for the lock
+    uint32_t max_lock_ticks;// Longest single wait for the lock
+    uint32_t ring_full;     // Posts that found the command ring full
+    uint32_t ring_ticks;    // Total time spent waiting for a free slot
+} I2C_CONTENTION;
 
 class I2C : public I_I2C
 {
 protected:
-    PAR_S   m_par;
+    PAR_S*  m_bus;          // Shared bus state, allocated by the owning handle
+    int     m_owner;        // 1 for the handle that started the bus, 0 for proxies
     int     m_ready;
+    int     m_lastSts;      // Result of the last command this handle waited on
+    int     m_regBytes;     // Fixed register address width, 0 to follow the value
+    int     m_page;         // Write page size for the cog to split at, 0 for none
+    I2CMultiBus*      m_multi;      // Shared driver cog, 0 when the bus has its own
+    I2C_WAIT          m_waitMode;
+    I2C_WAIT_LATENCY  m_latency;
+    I2C_CONTENTION    m_contention;
     
 public:
-    I2C(int scl, int sda, int freq = 100000);
+    I2C(int scl, int sda, int freq = 100000, int stretch = 1);
+    I2C(I2CMultiBus& driver, int scl, int sda, int freq = 100000, int stretch = 1);
+    I2C(I2C& bus);
     ~I2C();
     
     int openBus(uint8_t slaveAdr);
@@ -22,7 +68,12 @@ public:
     
     
     int devPresent(uint8_t addr);
+    int scan(uint32_t* map, uint8_t first = I2C_SCAN_FIRST, uint8_t last = I2C_SCAN_LAST);
+    int refreshInventory();
+    int getInventory(uint32_t* map);
+    int isPresent(uint8_t addr);
     int getCog();
+    int getBusFreq();
     int getStatus();
     int getRegByteCount(int32_t);
     
@@ -31,17 +82,71 @@ public:
     int txByte(int32_t reg, uint8_t byte);
     int txWord(uint16_t wd);
     int txWord(int32_t reg, uint16_t word);
+    int txLong(uint32_t lg);
+    int txLong(int32_t reg, uint32_t lg);
+    int txWords(int32_t reg, int16_t* words, int count, I2C_REG_ORDER order = I2C_REG_MSB_FIRST);
+    int txLongs(int32_t reg, int32_t* longs, int count, I2C_REG_ORDER order = I2C_REG_MSB_FIRST);
     
     int         rx(int32_t reg, uint8_t* bytes, int count);
     int8_t      rxByte();
     int8_t      rxByte(int32_t reg);
     int16_t     rxWord();
     int16_t     rxWord(int32_t reg);
+    int32_t     rxLong();
+    int32_t     rxLong(int32_t reg);
+    int         rxWords(int32_t reg, int16_t* words, int count, I2C_REG_ORDER order = I2C_REG_MSB_FIRST);
+    int         rxLongs(int32_t reg, int32_t* longs, int count, I2C_REG_ORDER order = I2C_REG_MSB_FIRST);
+    
+    int         txAsync(int32_t reg, uint8_t* bytes, int count);
+    int         rxAsync(int32_t reg, uint8_t* bytes, int count);
+    int         txReg(uint32_t reg, int rcnt, uint8_t* bytes, int count);
+    int         rxReg(uint32_t reg, int rcnt, uint8_t* bytes, int count);
+    int         txSeg(int32_t reg, I2C_SEGMENT* segs, int nsegs);
+    int         rxSeg(int32_t reg, I2C_SEGMENT* segs, int nsegs);
+    int         txSegAsync(int32_t reg, I2C_SEGMENT* segs, int nsegs);
+    int         rxSegAsync(int32_t reg, I2C_SEGMENT* segs, int nsegs);
+    int         isDone(int handle);
+    int         wait(int handle);
+    
+    int         batch(I2C_BATCH_ENTRY* entries, int count);
+    int         batchAsync(I2C_BATCH_ENTRY* entries, int count);
+    void        setBatchEntry(I2C_BATCH_ENTRY& e, uint8_t adr, int32_t reg, 
+                              uint8_t* bytes, int count, int read = 1);
+    
+    void        setWaitStrategy(I2C_WAIT mode);
+    void        getWaitLatency(I2C_WAIT_LATENCY* lat);
+    void        resetWaitLatency();
     
+    int         addPoll(uint8_t adr, int32_t reg, int count, uint32_t period_us);
+    int         addDrdyPoll(uint8_t adr, int32_t reg, int count, int pin, int activeHigh = 1,
+                            uint32_t stuck_us = 100000);
+    void        removePoll(int job);
+    int         readPoll(int job, uint8_t* bytes);
+    int         getPollStatus(int job);
+    
+    int         getStats(I2C_STATS* stats);
+    int         resetStats();
+    
+    void        setRegBytes(int bytes);
+    int         setPageSize(int bytes);
+    
+    void        getContention(I2C_CONTENTION* con);
+    void        resetContention();
 
     
 private:
+    I2C& operator=(const I2C&);         // Not assignable, use a proxy
+    
+    int  setup(int scl, int sda, int freq, int stretch);
+    void lockBus();
+    void unlockBus();
+    int  waitInit(uint32_t timeout);
     void WaitForIdle();
+    void pollDelay(int polls);
+    int  startPoll(uint8_t adr, int32_t reg, int count, uint32_t period_us, 
+                   uint32_t mask, uint32_t state);
+    int  submit(I2C_CMD cmd, uint8_t adr, int32_t reg, uint8_t* bytes, int count, 
+                uint8_t flags = 0, int rcnt = -1);
 };
 
 
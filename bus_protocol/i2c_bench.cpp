@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include "i2c_bench.h"
+
+static const int s_freqs[] = { 100000, 400000, 1000000 };
+static const int s_sizes[] = { 0, 1, 2, 4, 8, 16, 32, 64, 128, 255 };
+
+
+/** @brief Create a benchmark for the device at [adr] on the given pins.
+ *
+ *  @param int scl: SCL pin
+ *  @param int sda: SDA pin
+ *  @param uint8_t adr: 7 bit address of a device that ACKs writes and reads
+ */
+I2CBench::I2CBench(int scl, int sda, uint8_t adr)
+{
+    m_scl = scl;
+    m_sda = sda;
+    m_adr = adr;
+    m_failedFreq = 0;
+    
+    for (int i = 0; i < (int)sizeof(m_buf); i++)
+        m_buf[i] = i;
+}
+
+
+/** @brief Get the bus frequency run() gave up at.
+ *
+ *  @return int: Frequency in Hz whose bus or driver cog did not start, 0 if
+ *               the last run() started every bus
+ */
+int I2CBench::getFailedFreq()
+{
+    return m_failedFreq;
+}
+
+
+/** @brief Fill in the full default matrix.
+ *
+ *  100k/400k/1M, 0-255 bytes in powers of two, 0-4 register bytes, every mode
+ *  and 16 transactions per case with the caller spinning on a bus that
+ *  allows clock stretching.
+ */
+void I2CBench::defaultConfig(I2C_BENCH_CONFIG* cfg)
+{
+    cfg->freqs          = s_freqs;
+    cfg->nfreqs         = sizeof(s_freqs) / sizeof(s_freqs[0]);
+    cfg->sizes          = s_sizes;
+    cfg->nsizes         = sizeof(s_sizes) / sizeof(s_sizes[0]);
+    cfg->min_reg_bytes  = 0;
+    cfg->max_reg_bytes  = 4;
+    cfg->modes          = I2C_BENCH_WRITE | I2C_BENCH_READ | I2C_BENCH_MIX;
+    cfg->reps           = 16;
+    cfg->wait           = I2C_WAIT_SPIN;
+    cfg->stretch        = 1;
+}
+
+
+/** @brief Run every case of the matrix.
+ *
+ *  A bus and driver cog are started for each frequency in turn.  Cases that
+ *  had failed transactions are still reported, with their error count set.
+ *
+ *  @param I2C_BENCH_CONFIG& cfg: Cases to run
+ *  @param report: Called with each case's result, I2CBench::print for a table
+ *  @return int: Number of cases run, or -1 if a bus could not be started
+ *               (see getFailedFreq())
+ */
+int I2CBench::run(const I2C_BENCH_CONFIG& cfg, void (*report)(const I2C_BENCH_RESULT*))
+{
+    int cases = 0;
+    
+    m_failedFreq = 0;
+    
+    for (int f = 0; f < cfg.nfreqs; f++)
+    {
+        I2C bus(m_scl, m_sda, cfg.freqs[f], cfg.stretch);
+        
+        if (bus.getCog() < 0 || bus.openBus(m_adr) != 0 || !bus.isReady())
+        {
+            m_failedFreq = cfg.freqs[f];
+            return -1;
+        }
+        bus.setWaitStrategy(cfg.wait);
+        
+        for (int rb = cfg.min_reg_bytes; rb <= cfg.max_reg_bytes; rb++)
+            for (int s = 0; s < cfg.nsizes; s++)
+                for (int mode = I2C_BENCH_WRITE; mode <= I2C_BENCH_MIX; mode <<= 1)
+                {
+                    I2C_BENCH_RESULT res;
+                    
+                    if (!(cfg.modes & mode))
+                        continue;
+                    
+                    // A zero length read leaves the slave driving its first
+                    // bit into our STOP, only the write form is a valid probe
+                    if (cfg.sizes[s] == 0 && mode != I2C_BENCH_WRITE)
+                        continue;
+                    
+                    res.freq = cfg.freqs[f];
+                    runCase(bus, cfg.sizes[s], rb, mode, cfg.reps, &res);
+                    if (report)
+                        report(&res);
+                    cases++;
+                }
+    }
+    
+    return cases;
+}
+
+
+/** @brief Measure one case on an already started bus.
+ *
+ *  The caller sets res->freq to the requested bus frequency for the report.
+ *  The wire time is worked out from the rate the driver cog achieved, so the
+ *  overhead does not count the gap between the two as driver cost.
+ *
+ *  @param I2C& bus: Started bus, opened on the device
+ *  @param int size: Data bytes per transaction (0-255)
+ *  @param int reg_bytes: Register width (0-4)
+ *  @param int mode: One I2C_BENCH_MODE
+ *  @param int reps: Number of transactions
+ *  @param I2C_BENCH_RESULT* res: Filled with the measurements
+ *  @return int: 0 if every transaction succeeded, -1 otherwise
+ */
+int I2CBench::runCase(I2C& bus, int size, int reg_bytes, int mode, int reps,
+                      I2C_BENCH_RESULT* res)
+{
+    int32_t  reg  = reg_bytes ? (1 << ((reg_bytes - 1) << 3)) : -1;
+    uint32_t bits = 0;
+    uint32_t total = 0;
+    uint32_t post = 0;
+    I2C_WAIT_LATENCY lat;
+    
+    res->scl_freq   = bus.getBusFreq();
+    res->size       = size;
+    res->reg_bytes  = reg_bytes;
+    res->mode       = mode;
+    res->txns       = 0;
+    res->errors     = 0;
+    
+    bus.resetWaitLatency();
+    
+    for (int i = 0; i < reps; i++)
+    {
+        int read = (mode == I2C_BENCH_READ) || (mode == I2C_BENCH_MIX && (i & 1));
+        
+        uint32_t t0 = CNT;
+        int h = read ? bus.rxAsync(reg, m_buf, size) : bus.txAsync(reg, m_buf, size);
+        uint32_t t1 = CNT;
+        int rc = bus.wait(h);
+        uint32_t t2 = CNT;
+        
+        post  += t1 - t0;
+        total += t2 - t0;
+        bits  += wireBits(size, reg_bytes, read);
+        res->txns++;
+        if (rc != 0)
+            res->errors++;
+    }
+    
+    bus.getWaitLatency(&lat);
+    
+    if (reps > 0)
+    {
+        res->ticks      = total / reps;
+        res->post_ticks = post / reps;
+        res->wire_ticks = res->scl_freq ? (uint32_t)((uint64_t)bits * CLKFREQ / res->scl_freq / reps) : 0;
+    }
+    else
+        res->ticks = res->post_ticks = res->wire_ticks = 0;
+    
+    res->overhead       = res->ticks > res->wire_ticks ? res->ticks - res->wire_ticks : 0;
+    res->wake_ticks     = lat.count ? lat.total / lat.count : 0;
+    res->bytes_per_sec  = res->ticks ? (uint32_t)((uint64_t)size * CLKFREQ / res->ticks) : 0;
+    
+    return res->errors ? -1 : 0;
+}
+
+
+/** @brief Print the column headings for print().
+ */
+void I2CBench::printHeader()
+{
+    printf("%8s %8s %4s %3s %5s %4s %9s %9s %9s %6s %6s %8s\n",
+           "freq", "scl", "size", "reg", "mode", "err", "ticks", "wire", "overhead", 
+           "post", "wake", "B/s");
+}
+
+
+/** @brief Print one result as a table row, usable as the run() reporter.
+ */
+void I2CBench::print(const I2C_BENCH_RESULT* res)
+{
+    static const char* modes[] = { "", "write", "read", "", "mix" };
+    
+    printf("%8d %8d %4d %3d %5s %4u %9u %9u %9u %6u %6u %8u\n",
+           res->freq, res->scl_freq, res->size, res->reg_bytes, modes[res->mode], 
+           (unsigned)res->errors, (unsigned)res->ticks, (unsigned)res->wire_ticks,
+           (unsigned)res->overhead, (unsigned)res->post_ticks, 
+           (unsigned)res->wake_ticks, (unsigned)res->bytes_per_sec);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Private Members
+//
+
+uint32_t I2CBench::wireBits(int size, int reg_bytes, int read)
+{   // SCL periods on the wire: 9 per byte plus START, repeated START and STOP
+    uint32_t bits = 2 + 9 * (1 + size);
+    
+    if (!read)
+        bits += 9 * reg_bytes;
+    else if (reg_bytes)
+        bits += 9 * (reg_bytes + 1) + 1;
+    
+    return bits;
+}
+
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
@@ -0,0 +1,105 @@
+#ifndef __I2C_BENCH_H__
+#define __I2C_BENCH_H__
+
+#include "i2c.h"
+
+// Transfer directions a benchmark case can run
+enum I2C_BENCH_MODE
+{
+    I2C_BENCH_WRITE = 1,        // Register writes only
+    I2C_BENCH_READ  = 2,        // Register reads only
+    I2C_BENCH_MIX   = 4         // Alternating writes and reads
+};
+
+
+// Matrix of cases to run, every combination of the lists is measured
+typedef struct I2C_BENCH_CONFIG
+{
+    const int*  freqs;          // Bus frequencies in Hz
+    int         nfreqs;
+    const int*  sizes;          // Data bytes per transaction (0-255)
+    int         nsizes;
+    int         min_reg_bytes;  // Smallest register width (0 for none)
+    int         max_reg_bytes;  // Largest register width (up to 4)
+    int         modes;          // I2C_BENCH_MODE bits
+    int         reps;           // Transactions per case
+    I2C_WAIT    wait;           // Wait strategy for the calling cog
+    int         stretch;        // 0 when no device stretches SCL (see I2C::I2C)
+} I2C_BENCH_CONFIG;
+
+
+// Measurements for one case, times are in clock ticks
+typedef struct I2C_BENCH_RESULT
+{
+    int         freq;           // Bus frequency requested
+    int         scl_freq;       // Bus frequency the driver cog achieved
+    int         size;           // Data bytes per transaction
+    int         reg_bytes;      // Register width
+    int         mode;           // I2C_BENCH_MODE
+    uint32_t    txns;           // Transactions run
+    uint32_t    errors;         // Transactions that failed
+    uint32_t    ticks;          // Average post-to-completion time per transaction
+    uint32_t    wire_ticks;     // Time the bits themselves need at [scl_freq]
+    uint32_t    overhead;       // ticks - wire_ticks
+    uint32_t    post_ticks;     // Average time to post a transaction to the ring
+    uint32_t    wake_ticks;     // Average completion-to-wake latency of wait()
+    uint32_t    bytes_per_sec;  // Effective data rate
+} I2C_BENCH_RESULT;
+
+
+/** @brief Throughput and latency benchmark for the I2C driver.
+ *
+ *  Runs a matrix of transfer sizes, register widths, bus frequencies and
+ *  read/write mixes against one device and measures each case with CNT, so
+ *  the same code reports on the chip and on the host simulation.  The device 
+ *  only has to ACK; the data is not checked.
+ */
+class I2CBench
+{
+public:
+    I2CBench(int scl, int sda, uint8_t adr);
+
+    int         run(const I2C_BENCH_CONFIG& cfg, void (*report)(const I2C_BENCH_RESULT*));
+    int         runCase(I2C& bus, int size, int reg_bytes, int mode, int reps,
+                        I2C_BENCH_RESULT* res);
+
+    int         getFailedFreq();
+    
+    static void defaultConfig(I2C_BENCH_CONFIG* cfg);
+    static void printHeader();
+    static void print(const I2C_BENCH_RESULT* res);
+
+protected:
+    int         m_scl;
+    int         m_sda;
+    uint8_t     m_adr;
+    int         m_failedFreq;   // Frequency whose bus did not start, 0 if none
+    uint8_t     m_buf[256];
+
+    static uint32_t wireBits(int size, int reg_bytes, int read);
+};
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
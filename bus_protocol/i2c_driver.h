@@ -10,6 +10,30 @@
 #define I2C_READ        1
 #define I2C_WRITE       0
 
+#define I2C_RING_SIZE   8       // Mailbox slots in the command ring (power of 2)
+#define I2C_POLL_MAX    4       // Autonomous polling jobs per bus
+#define I2C_POLL_BYTES  16      // Largest result a polling job can hold
+#define I2C_STRETCH_WAIT_SHIFT 5  // Abandon a clock stretch after CLKFREQ >> 5 (~31ms, the SMBus timeout)
+#define I2C_FREQ_MAX    1000000 // Fast-mode Plus
+#define I2C_BUS_MAX     8       // Buses one multi-bus driver cog can serve
+#define I2C_COUNT_MAX   65535   // Largest single transfer in bytes
+#define I2C_PAGE_WAIT_SHIFT 6   // ACK poll a page write for up to CLKFREQ >> 6 (~15ms)
+#define I2C_SCAN_FIRST  0x08    // Lowest address a default scan probes
+#define I2C_SCAN_LAST   0x77    // Highest address a default scan probes
+#define I2C_SCAN_WORDS  4       // 32 bit words in a 128 bit presence map
+#ifndef I2C_INIT_WAIT_SHIFT
+#define I2C_INIT_WAIT_SHIFT 8   // Give a new cog CLKFREQ >> 8 (~3.9ms) to bring the bus up
+#endif
+
+// I2C_MAILBOX flags
+#define I2C_MBOX_SEGMENTS   1   // buffer is a list of [count] I2C_SEGMENTs
+
+// I2C_INIT flags
+#define I2C_INIT_NO_STRETCH 1   // Skip clock stretch checks, no slave on the bus stretches
+
+// Build both i2c.cpp and i2c_driver.cogc with I2C_DRIVER_STATS defined to have the
+// cog keep an I2C_STATS block in hub RAM.  Without it the counters cost nothing.
+
 // I2C Commands
 typedef enum I2C_CMD
 {
@@ -17,7 +41,10 @@ typedef enum I2C_CMD
     I2C_CMD_INIT,           // Initialize the bus
     I2C_CMD_LOCKED,         // Marks the bus as locked but not yet active
     I2C_CMD_SEND,           // Send data bytes to the bus at a register address
-    I2C_CMD_RECEIVE         // Recieve data bytes from the bus at a register address
+    I2C_CMD_RECEIVE,        // Recieve data bytes from the bus at a register address
+    I2C_CMD_BATCH,          // Run a list of I2C_BATCH_ENTRY transactions in one command
+    I2C_CMD_STATS_RESET,    // Clear the I2C_STATS block (I2C_DRIVER_STATS builds only)
+    I2C_CMD_SCAN            // Probe [count] addresses from [reg] into the presence map at buffer
 } I2C_CMD;
 
 
@@ -29,47 +56,186 @@ typedef enum I2C_RESULT
     I2C_ERR_SEND_HDR,		// Address or Register as not acknowleged
     I2C_ERR_SEND,			// Data transmitted was not acknowleged
     I2C_ERR_RECEIVE_HDR,	// Address or register is not acknowleged
-    I2C_ERR_RECEIVE
+    I2C_ERR_RECEIVE,
+    I2C_ERR_TIMEOUT,		// A slave held SCL low too long, the bus was reset
+    I2C_ERR_EXPIRED			// The handle's ring slot was reused before its status was read
 } I2C_RESULT;
 
  
 ///////////////////////////////////////////////////////////////////////////////////////
 // I2C_MAILBOX structure - 	Groups parameters used to pass commands to the I2C cog for
-//							control and data transmission.
+//							control and data transmission.  A write with page set is
+//							split wherever the register (memory) address crosses a
+//							page boundary, and the cog ACK polls the device through
+//							its write cycle before going on, as 24xx EEPROMs need.
+//							I2C_CMD_SCAN sets bit (adr & 31) of word (adr >> 5) in
+//							the I2C_SCAN_WORDS map at buffer for every address that
+//							ACKs, and clears the rest.  seq lets a waiter tell its
+//							own command's sts and stamp from those of a later one
+//							another producer has since posted to the slot.
 //
 typedef struct I2C_MAILBOX
 {
     volatile uint32_t cmd;       // Primative I2C command (SEE I2C_CMD Enum)
     volatile uint32_t sts;       // Last command status (SEE I2C_RESULT Enum)
+    volatile uint32_t reg;       // Register address for register read/write (32 bit max)
     volatile uint8_t  hdr;       // I2C address header (The 8bit WRITE address of the I2C device)
-    volatile uint16_t reg;       // Register address for register read/write (16 bit max)
-    volatile uint8_t  reg_count; // Number of register bytes to send   (1|2)
-    volatile uint8_t  count;     // Number of bytes to be sent/recv'd
+    volatile uint8_t  reg_count; // Number of register bytes to send   (0-4)
+    volatile uint16_t count;     // Number of bytes to be sent/recv'd (segments with I2C_MBOX_SEGMENTS)
+    volatile uint8_t  flags;     // I2C_MBOX_xxx options
+    volatile uint16_t page;      // Split writes at multiples of this many bytes (power of 2, 0 for none)
     uint8_t*          buffer;    // Pointer to data to be sent/recv'd
+    volatile uint32_t stamp;     // CNT when the cog retired the command
+    volatile uint32_t seq;       // Handle of the command, written by the producer before cmd
 } I2C_MAILBOX;
 
 
+//////////////////////////////////////////////////////////////////////////////////////
+// I2C_SEGMENT structure - 	One piece of a scatter/gather transfer.  The cog sends or
+//							fills the segments back to back as one data phase, straight
+//							from and into caller memory.
+//
+typedef struct I2C_SEGMENT
+{
+    uint8_t*          buffer;    // Start of this piece
+    uint32_t          count;     // Bytes in this piece (may be 0)
+} I2C_SEGMENT;
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// I2C_BATCH_ENTRY structure - 	One transaction of an I2C_CMD_BATCH command.  The mailbox
+//								buffer points at an array of these and count holds the
+//								number of entries.  The array must stay in scope until
+//								the command completes.
+//
+typedef struct I2C_BATCH_ENTRY
+{
+    uint8_t           hdr;       // I2C address header, I2C_READ bit set for a read
+    uint8_t           reg_count; // Number of register bytes to send   (0-4)
+    uint16_t          count;     // Number of bytes to be sent/recv'd
+    volatile uint8_t  sts;       // Result of this entry (SEE I2C_RESULT Enum)
+    uint32_t          reg;       // Register address for register read/write
+    uint8_t*          buffer;    // Pointer to data to be sent/recv'd
+} I2C_BATCH_ENTRY;
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// I2C_POLL_JOB structure -	A register read the cog runs on its own every [period] 
+//							ticks while the command ring is idle.  Results are double
+//							buffered: the cog fills data[(seq + 1) & 1] and then bumps
+//							seq, so the latest complete result is always data[seq & 1].
+//							With drdy_mask set the read is fired instead by the data
+//							ready pin reaching drdy_state after it was last seen 
+//							inactive, or after [period] ticks if it stays active.
+//
+typedef struct I2C_POLL_JOB
+{
+    uint8_t           hdr;       // I2C address header (The 8bit WRITE address of the I2C device)
+    uint8_t           reg_count; // Number of register bytes to send   (0-4)
+    uint8_t           count;     // Number of bytes to read each period
+    volatile uint8_t  sts;       // Result of the latest read (SEE I2C_RESULT Enum)
+    uint32_t          reg;       // Register address to read from
+    uint32_t          drdy_mask; // Data ready pin mask, 0 for a timed job
+    uint32_t          drdy_state;// INA & drdy_mask while data is ready
+    volatile uint32_t armed;     // Data ready went inactive since the last read (cog use)
+    volatile uint32_t period;    // Ticks between reads, 0 when the job is unused
+    volatile uint32_t next;      // CNT the next read is due
+    volatile uint32_t seq;       // Number of completed reads
+    uint8_t           data[2][I2C_POLL_BYTES];
+} I2C_POLL_JOB;
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// I2C_STATS structure -	Instrumentation counters the cog updates after every bus
+//							transaction, polls included, when built with 
+//							I2C_DRIVER_STATS.  Durations are CNT ticks from START to 
+//							STOP; the average is total_ticks / txns.
+//
+typedef struct I2C_STATS
+{
+    volatile uint32_t txns;             // Bus transactions run
+    volatile uint32_t errors;           // Transactions that did not return I2C_OK
+    volatile uint32_t bytes;            // Data bytes moved, not counting address or register
+    volatile uint32_t stretch_timeouts; // Clock stretches abandoned (I2C_STRETCH_WAIT_SHIFT)
+    volatile uint32_t recoveries;       // Bus recovery sequences run
+    volatile uint32_t min_ticks;        // Shortest transaction (0xFFFFFFFF until the first)
+    volatile uint32_t max_ticks;        // Longest transaction
+    volatile uint32_t total_ticks;      // Sum of all transaction durations
+    volatile uint16_t nacks[128];       // NACKed transactions by 7 bit address
+} I2C_STATS;
+
+
 //////////////////////////////////////////////////////////////////////////////////////
 // Initialization structure - 	Groups parameters used to setup the operation
 //   							of the I2C cog
 typedef struct I2C_INIT
 {
-    volatile I2C_MAILBOX *mailbox;  // Pointer to the cogs HUB mailbox
+    volatile I2C_MAILBOX *mailbox;  // Pointer to the first slot of the cogs HUB command ring
+    volatile uint32_t *tail;        // Pointer to the ring's completed command counter
+    volatile I2C_POLL_JOB *poll;    // Pointer to the I2C_POLL_MAX polling jobs
+    I2C_SEGMENT *single;            // Hub scratch segment for plain buffer transfers
+#ifdef I2C_DRIVER_STATS
+    volatile I2C_STATS *stats;      // Pointer to the instrumentation block
+#endif
     uint32_t scl;                   // SCL IO Pin
     uint32_t sda;                   // SDA IO Pin
-    uint32_t ticks_per_cycle;       // Clock delay time
+    uint32_t ticks_per_cycle;       // Requested SCL period in ticks, the cog writes back the actual one
+    uint32_t flags;                 // I2C_INIT_xxx options
+    uint32_t half_cycle;            // Bit delay the cog settled on (written by the cog)
 } I2C_INIT;
 
 
 //////////////////////////////////////////////////////////////////////////////////////
-// PAR_S Structure -	Creates the reserved memory locations for the mailbox, the init
-//						structure, and a small stack for the COG.  This structure must
-//						remain in scope for the life of the COG attached to it.
+// I2C_MULTI_INIT structure - 	PAR block of the multi-bus driver cog.  A bus joins by
+//								storing its I2C_INIT in a free slot with ring[0] set to
+//								I2C_CMD_INIT, and the cog brings it up on its next pass.
+//								A bus leaves by clearing its slot and waiting for pass
+//								to move on, after which the cog no longer uses it.
+//
+typedef struct I2C_MULTI_INIT
+{
+    volatile I2C_INIT * volatile bus[I2C_BUS_MAX];  // Registered buses, 0 for a free slot
+    volatile uint32_t pass;         // Count of completed scheduling passes
+    uint32_t priority;              // 0 round-robin, 1 lower slots first
+} I2C_MULTI_INIT;
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// I2C_MULTI_PAR Structure -	Hub block of the multi-bus driver cog.  As in PAR_S the
+//								stack comes first, since the COG's stack grows down
+//								from the init block PAR points at.
+//
+typedef struct I2C_MULTI_PAR
+{
+    uint32_t stack[8];		// COG Execution stack
+    I2C_MULTI_INIT init;	// COG Initialization Parameters
+} I2C_MULTI_PAR;
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// PAR_S Structure -	Creates the reserved memory locations for the command ring, the 
+//						init structure, and a small stack for the COG.  This structure 
+//						must remain in scope for the life of the COG attached to it.
+//
+//						Producers fill ring[head % I2C_RING_SIZE] while holding the lock
+//						and write the slot's cmd last.  The COG runs slots in order and
+//						bumps tail after each one, so a slot is free again once 
+//						head - tail < I2C_RING_SIZE.
 typedef struct PAR_S
 {
     uint32_t stack[8];		// COG Execution stack
     I2C_INIT init; 			// COG Initialization Parameters
-    I2C_MAILBOX mailbox;  	// COG Communication mailbox
+    I2C_MAILBOX ring[I2C_RING_SIZE];  // COG Communication mailbox ring
+    volatile uint32_t head;	// Count of commands posted by producers
+    volatile uint32_t tail;	// Count of commands completed by the COG
+    int32_t lock;			// Hardware lock serializing producers (-1 if none)
+    I2C_POLL_JOB poll[I2C_POLL_MAX];  // Autonomous polling jobs
+    I2C_SEGMENT single;		// Scratch segment the COG runs plain buffers through
+#ifdef I2C_DRIVER_STATS
+    I2C_STATS stats;		// Instrumentation counters kept by the COG
+#endif
+    uint32_t present[I2C_SCAN_WORDS];  // Cached device inventory (see I2C::refreshInventory)
+    volatile int32_t scanned;  // 1 once present has been filled
     int32_t cog; 			// COG Number used for this bus (if started)
 } PAR_S;
 
@@ -0,0 +1,232 @@
+#include "i2c_eeprom.h"
+
+
+/** @brief Attach to a memory chip on an already started bus.
+ *
+ *  @param I2C& bus: Bus the chip is on, must outlive this object
+ *  @param uint8_t adr: 7 bit device address of the chip's first block
+ *  @param uint32_t size: Capacity in bytes
+ *  @param int page: Write page size in bytes (power of 2), 0 for FRAM
+ *  @param int addrBytes: Memory address bytes the chip expects (1|2)
+ */
+I2CEeprom::I2CEeprom(I2C& bus, uint8_t adr, uint32_t size, int page, int addrBytes) 
+    : m_dev(bus)
+{
+    m_adr       = adr;
+    m_size      = size;
+    m_page      = page;
+    m_addrBytes = addrBytes;
+    m_last      = -1;
+    m_busy      = 0;
+    
+    m_dev.openBus(adr);
+    m_dev.setRegBytes(addrBytes);
+    if ((addrBytes != 1 && addrBytes != 2) || m_dev.setPageSize(page) != 0)
+        m_size = 0;                     // Bad geometry, refuse every access
+}
+
+
+/** @brief Check that the bus can be used and the chip answers.
+ *
+ *  @return int: 1 if ready, 0 if not
+ */
+int I2CEeprom::isReady()
+{
+    if (!m_dev.isReady() || m_size == 0)
+        return 0;
+    
+    return sync() == 0 ? 1 : 0;
+}
+
+
+/** @brief Get the capacity in bytes.
+ */
+uint32_t I2CEeprom::getSize()
+{
+    return m_size;
+}
+
+
+/** @brief Read a range of the chip.
+ *
+ *  Waits out any write still being programmed, then reads each address 
+ *  block in a single command.
+ *
+ *  @param uint32_t addr: First byte to read
+ *  @param uint8_t* buf: Destination
+ *  @param uint32_t len: Number of bytes
+ *  @return int: 0 on success, -1 on bus error or a range outside the chip
+ */
+int I2CEeprom::read(uint32_t addr, uint8_t* buf, uint32_t len)
+{
+    if (sync() != 0)
+        return -1;
+    
+    return transfer(0, addr, buf, len, 1);
+}
+
+
+/** @brief Write a range of the chip.
+ *
+ *  Returns once the data has been sent, the chip may still be programming
+ *  the last page.  Any later access waits for that on its own.
+ *
+ *  @param uint32_t addr: First byte to write
+ *  @param uint8_t* buf: Data to write
+ *  @param uint32_t len: Number of bytes
+ *  @return int: 0 on success, -1 on bus error or a range outside the chip
+ */
+int I2CEeprom::write(uint32_t addr, uint8_t* buf, uint32_t len)
+{
+    if (m_last >= 0 && sync() != 0)
+        return -1;
+    
+    return transfer(1, addr, buf, len, 1);
+}
+
+
+/** @brief Post a write of a range of the chip and return without waiting.
+ *
+ *  The driver cog works through the pages while the caller carries on.  
+ *  [buf] must stay valid until sync() returns or the handle completes.
+ *  Further writes can be posted straight away; they queue up behind this one.
+ *
+ *  Only one command of this chip is left in flight: posting the next one
+ *  (the next address block, or the next writeAsync()) first collects the
+ *  result of the one before, so a failed block is reported rather than lost.
+ *
+ *  @param uint32_t addr: First byte to write
+ *  @param uint8_t* buf: Data to write
+ *  @param uint32_t len: Number of bytes
+ *  @return int: Handle of the last command posted (see I2C::wait), 0 for an
+ *               empty write, or -1 on error, including an earlier block or
+ *               earlier posted write that failed
+ */
+int I2CEeprom::writeAsync(uint32_t addr, uint8_t* buf, uint32_t len)
+{
+    return transfer(1, addr, buf, len, 0);
+}
+
+
+/** @brief Wait for posted writes to finish and the chip to be ready again.
+ *
+ *  @return int: 0 on success, -1 if the last posted write failed or the chip
+ *               did not come back within I2C_EEPROM_READY_MS
+ */
+int I2CEeprom::sync()
+{
+    int rc = 0;
+    
+    if (m_last >= 0)
+    {
+        rc = m_dev.wait(m_last);
+        m_last = -1;
+    }
+    
+    if (m_busy && waitReady() != 0)
+        rc = -1;
+    
+    return rc;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Private Members
+//
+
+int I2CEeprom::transfer(int write, uint32_t addr, uint8_t* buf, uint32_t len, int block)
+{/* Post one command per address block (and per I2C_COUNT_MAX bytes).  With
+    [block] set wait on each and return 0/-1, else return the last handle,
+    having collected each earlier one as the next went out. */
+    
+    uint32_t span   = 1UL << (m_addrBytes << 3);     // m_addrBytes is 1 or 2
+    uint32_t limit  = I2C_COUNT_MAX;
+    int      rc     = 0;
+    int      failed = 0;
+    
+    if (m_size == 0 || addr > m_size || len > m_size - addr)
+        return -1;
+    
+    if (write && m_page)
+        limit &= ~(uint32_t)(m_page - 1);       // Keep chunks page aligned
+    
+    while (len > 0)
+    {
+        uint32_t n = span - (addr & (span - 1));
+        if (n > len)
+            n = len;
+        if (n > limit)
+            n = limit;
+        
+        // Address bits beyond the address bytes select the block
+        uint8_t dev = m_adr | (addr >> (m_addrBytes << 3));
+        m_dev.openBus(dev);
+        if (write && m_page)
+            m_busy = dev;                       // Only the last block written can be busy
+        
+        int h = write ? m_dev.txAsync(addr & (span - 1), buf, n)
+                      : m_dev.rxAsync(addr & (span - 1), buf, n);
+        if (h < 0)
+            return -1;
+        
+        if (block)
+        {
+            if (m_dev.wait(h) != 0)
+                rc = -1;
+        }
+        else
+        {   // Its ring slot gets reused, so collect the previous command now
+            if (m_last >= 0 && m_dev.wait(m_last) != 0)
+                failed = 1;
+            m_last = h;
+            rc     = h;
+        }
+        
+        addr += n;
+        buf  += n;
+        len  -= n;
+    }
+    
+    return failed ? -1 : rc;
+}
+
+
+int I2CEeprom::waitReady()
+{/* ACK poll with header only probes until the chip answers again */
+    
+    uint32_t start = CNT;
+    uint32_t limit = (CLKFREQ / 1000) * I2C_EEPROM_READY_MS;
+    
+    while (!m_dev.devPresent(m_busy))
+        if (CNT - start > limit)
+            return -1;
+    
+    m_busy = 0;
+    return 0;
+}
+
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
@@ -0,0 +1,76 @@
+#ifndef __I2C_EEPROM_H__
+#define __I2C_EEPROM_H__
+
+#include "i2c.h"
+
+#define I2C_EEPROM_READY_MS     20      // Longest write cycle to ACK poll through
+
+
+/** @brief Block storage on a 24xx serial EEPROM or I2C FRAM.
+ *
+ *  Reads and writes any range of the part.  A write goes to the driver cog 
+ *  as one command per address block.  The cog splits it at page boundaries
+ *  and ACK polls the chip through each page's write cycle itself, so the 
+ *  caller never sleeps a fixed 5ms.  Writes return as soon as the data is 
+ *  on the chip.  The next read ACK polls with devPresent() until the last 
+ *  write cycle is over, and the next write is held off by the cog, so back
+ *  to back operations run at bus speed.
+ *
+ *  Addresses wider than [addrBytes] spill into the low bits of the device
+ *  address, as on 24xx04/08/16 and 24xx1026 style parts.  FRAM is a page 
+ *  size of 0: no splitting and no write cycle.
+ *
+ *  The device is driven through a proxy handle on [bus], so the bus needs a
+ *  hardware lock and its own address and settings are left alone.
+ */
+class I2CEeprom
+{
+public:
+    I2CEeprom(I2C& bus, uint8_t adr, uint32_t size, int page = 64, int addrBytes = 2);
+    
+    int         isReady();
+    uint32_t    getSize();
+    
+    int         read(uint32_t addr, uint8_t* buf, uint32_t len);
+    int         write(uint32_t addr, uint8_t* buf, uint32_t len);
+    int         writeAsync(uint32_t addr, uint8_t* buf, uint32_t len);
+    int         sync();
+    
+protected:
+    I2C         m_dev;          // Proxy handle on the caller's bus
+    uint8_t     m_adr;          // 7 bit device address of block 0
+    uint32_t    m_size;         // Capacity in bytes
+    int         m_page;         // Write page size, 0 for FRAM
+    int         m_addrBytes;    // Memory address bytes sent (1|2)
+    int         m_last;         // Handle of the last write posted, -1 for none
+    uint8_t     m_busy;         // Block address that may still be in a write cycle, 0 if none
+    
+private:
+    int         transfer(int write, uint32_t addr, uint8_t* buf, uint32_t len, int block);
+    int         waitReady();
+};
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
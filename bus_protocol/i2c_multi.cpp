@@ -0,0 +1,176 @@
+#include <string.h>
+#include "i2c_multi.h"
+
+extern uint32_t _load_start_I2CMultiDriver_cog[];
+extern uint32_t _load_stop_I2CMultiDriver_cog[];
+
+
+/** @brief Start the shared driver cog.  Buses are added by the I2C constructor.
+ *
+ *  @param int priority: 0 to serve the buses round-robin, one command each per
+ *                       pass; 1 to always serve the lowest numbered bus with 
+ *                       work first
+ */
+I2CMultiBus::I2CMultiBus(int priority)
+{
+    for (int i = 0; i < I2C_BUS_MAX; i++)
+        m_par.init.bus[i]   = 0;
+    m_par.init.pass         = 0;
+    m_par.init.priority     = priority ? 1 : 0;
+    m_lock                  = locknew();    // -1 leaves attach/detach to one cog
+    
+    // Start the COG according to the method needed for LMM/XMM memory models
+    #if defined(__PROPELLER_XMMC__) || defined(__PROPELLER_XMM__)
+        int size = _load_stop_I2CMultiDriver_cog - _load_start_I2CMultiDriver_cog;
+        unsigned int cogbuffer[size];
+        memcpy(cogbuffer, _load_start_I2CMultiDriver_cog, size<<2);
+    #else
+        int *cogbuffer = (int*)_load_start_I2CMultiDriver_cog;
+    #endif
+    
+    m_cog = cognew(cogbuffer, &m_par.init);
+}
+
+
+I2CMultiBus::~I2CMultiBus()
+{
+    if (m_cog >= 0)
+    {
+        cogstop(m_cog);
+        m_cog = -1;
+    }
+    
+    if (m_lock >= 0)
+    {
+        lockret(m_lock);
+        m_lock = -1;
+    }
+}
+
+
+/** @brief Get the shared driver cog.
+ *
+ *  @return int: Cog number, or -1 if it could not be started
+ */
+int I2CMultiBus::getCog()
+{
+    return m_cog;
+}
+
+
+/** @brief Count the buses currently served.
+ */
+int I2CMultiBus::getBusCount()
+{
+    int n = 0;
+    
+    for (int i = 0; i < I2C_BUS_MAX; i++)
+        if (m_par.init.bus[i] != 0)
+            n++;
+    
+    return n;
+}
+
+
+/** @brief Hand a bus to the driver cog.  Called by the I2C constructor.
+ *
+ *  The bus's ring[0] must hold I2C_CMD_INIT; the cog sets it to I2C_CMD_IDLE
+ *  once the pins are set up and the bit delay calibrated.  Buses may be
+ *  attached from several cogs at once, the slot table is claimed under the
+ *  driver's hardware lock.
+ *
+ *  @param I2C_INIT* init: The bus's initialization block
+ *  @return int: Slot used, or -1 if the cog is not running or all slots are taken
+ */
+int I2CMultiBus::attach(I2C_INIT* init)
+{
+    if (m_cog < 0)
+        return -1;
+    
+    lockSlots();
+    
+    for (int i = 0; i < I2C_BUS_MAX; i++)
+        if (m_par.init.bus[i] == 0)
+        {
+            m_par.init.bus[i] = init;       // Cog sees the bus from here
+            unlockSlots();
+            return i;
+        }
+    
+    unlockSlots();
+    return -1;
+}
+
+
+/** @brief Take a bus away from the driver cog.  Called by the I2C destructor.
+ *
+ *  Returns once the cog has finished its current pass, so the bus's memory
+ *  can be released.  Commands still queued on the bus are dropped.
+ *
+ *  @param I2C_INIT* init: The bus's initialization block
+ */
+void I2CMultiBus::detach(I2C_INIT* init)
+{
+    int found = 0;
+    
+    lockSlots();
+    for (int i = 0; i < I2C_BUS_MAX; i++)
+        if (m_par.init.bus[i] == init)
+        {
+            m_par.init.bus[i] = 0;
+            found = 1;
+        }
+    unlockSlots();
+    
+    if (!found)
+        return;
+    
+    uint32_t pass = m_par.init.pass;
+    while (m_cog >= 0 && m_par.init.pass == pass)
+        ;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Private Members
+//
+
+void I2CMultiBus::lockSlots()
+{   // Serialize cogs changing the slot table, the driver cog only reads it
+    if (m_lock >= 0)
+        while (lockset(m_lock))
+            ;
+}
+
+
+void I2CMultiBus::unlockSlots()
+{
+    if (m_lock >= 0)
+        lockclr(m_lock);
+}
+
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
@@ -0,0 +1,62 @@
+#ifndef __I2C_MULTI_H__
+#define __I2C_MULTI_H__
+
+#include "i2c_driver.h"
+
+
+/** @brief One driver cog shared by several I2C buses.
+ *
+ *  Create one of these, then pass it to the I2C constructor of each bus in
+ *  place of starting a cog per bus.  Every bus keeps its own pins, frequency,
+ *  command ring and polling jobs and its I2C object works exactly as with a
+ *  dedicated cog.  Buses take turns a command at a time (round-robin) or, 
+ *  with priority scheduling, the bus created first is always served first.
+ *  Transactions on different buses never overlap, so a long transfer on one
+ *  bus holds up the others.
+ *
+ *  Destroy the I2C objects before the I2CMultiBus they use.
+ */
+class I2CMultiBus
+{
+public:
+    I2CMultiBus(int priority = 0);
+    ~I2CMultiBus();
+    
+    int         getCog();
+    int         getBusCount();
+    int         attach(I2C_INIT* init);
+    void        detach(I2C_INIT* init);
+    
+protected:
+    I2C_MULTI_PAR   m_par;          // Stack and PAR block of the cog
+    int             m_cog;
+    int             m_lock;         // Hardware lock guarding the bus slots (-1 if none)
+    
+    void            lockSlots();
+    void            unlockSlots();
+};
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
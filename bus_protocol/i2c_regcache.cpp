@@ -0,0 +1,348 @@
+#include <stdlib.h>
+#include <string.h>
+#include "i2c_regcache.h"
+
+
+/** @brief Create a cache of [size] registers starting at [base] for one device.
+ *
+ *  Nothing is read from the device until a register is read or loaded.
+ *
+ *  @param I2C& bus: Bus the device is on, must outlive the cache
+ *  @param uint8_t adr: 7 bit device address
+ *  @param int size: Number of registers to cover
+ *  @param int32_t base: Register address of the first register covered
+ */
+I2CRegCache::I2CRegCache(I2C& bus, uint8_t adr, int size, int32_t base) : m_bus(bus)
+{
+    m_adr       = adr;
+    m_base      = base;
+    m_size      = size;
+    m_maxBurst  = 255;
+    m_shadow    = (uint8_t *) calloc(size, 1);
+    m_flags     = (uint8_t *) calloc(size, 1);   // Nothing valid or dirty yet
+    
+    if (m_shadow == 0 || m_flags == 0)
+        m_size = 0;                         // Every access fails range checks
+    else
+        setVolatile(base, size, 1);
+}
+
+
+I2CRegCache::~I2CRegCache()
+{
+    free(m_shadow);
+    free(m_flags);
+}
+
+
+/** @brief Set one register.  The value is sent by the next flush().
+ *
+ *  @param int32_t reg: Register address
+ *  @param uint8_t val: New value
+ *  @return int: 0 on success, -1 if the register is not cached
+ */
+int I2CRegCache::write(int32_t reg, uint8_t val)
+{
+    return write(reg, &val, 1);
+}
+
+
+/** @brief Set a run of registers.  The values are sent by the next flush().
+ *
+ *  A non-volatile register that is known to hold the value already is left 
+ *  alone and costs no bus traffic.
+ *
+ *  @param int32_t reg: First register address
+ *  @param uint8_t* bytes: New values
+ *  @param int count: Number of registers
+ *  @return int: 0 on success, -1 if any register is not cached
+ */
+int I2CRegCache::write(int32_t reg, uint8_t* bytes, int count)
+{
+    if (!inRange(reg, count))
+        return -1;
+    
+    for (int i = reg - m_base; count > 0; i++, count--)
+    {
+        uint8_t val = *bytes++;
+        
+        if ((m_flags[i] & (I2C_REG_VALID | I2C_REG_VOLATILE)) == I2C_REG_VALID &&
+            m_shadow[i] == val)
+            continue;
+        
+        m_shadow[i] = val;
+        m_flags[i] |= I2C_REG_VALID | I2C_REG_DIRTY;
+    }
+    
+    return 0;
+}
+
+
+/** @brief Get one register.
+ *
+ *  @param int32_t reg: Register address
+ *  @param uint8_t* val: Receives the value
+ *  @return int: 0 on success, -1 on bus error or if the register is not cached
+ */
+int I2CRegCache::read(int32_t reg, uint8_t* val)
+{
+    return read(reg, val, 1);
+}
+
+
+/** @brief Get a run of registers.
+ *
+ *  Served from the cache when every register in the run is non-volatile and
+ *  known, otherwise the whole run is read from the device in one burst after
+ *  any pending writes have been flushed.
+ *
+ *  @param int32_t reg: First register address
+ *  @param uint8_t* bytes: Receives the values
+ *  @param int count: Number of registers (1-255)
+ *  @return int: 0 on success, -1 on bus error or if any register is not cached
+ */
+int I2CRegCache::read(int32_t reg, uint8_t* bytes, int count)
+{
+    if (!inRange(reg, count))
+        return -1;
+    
+    int first = reg - m_base;
+    int i;
+    
+    for (i = first; i < first + count; i++)
+        if ((m_flags[i] & (I2C_REG_VALID | I2C_REG_VOLATILE)) != I2C_REG_VALID)
+            break;
+    
+    if (i < first + count && load(reg, count) != 0)
+        return -1;
+    
+    memcpy(bytes, &m_shadow[first], count);
+    return 0;
+}
+
+
+/** @brief Send every register written since the last flush.
+ *
+ *  Runs of adjacent changed registers go out as single bursts of up to the
+ *  setMaxBurst() size, and up to I2C_REGCACHE_BATCH bursts share one batch
+ *  command.  Registers are sent in address order, not the order written.  
+ *  Registers whose burst fails stay pending for the next flush().
+ *
+ *  @return int: 0 when everything was sent, -1 if any burst failed
+ */
+int I2CRegCache::flush()
+{
+    I2C_BATCH_ENTRY entry[I2C_REGCACHE_BATCH];
+    int n  = 0;
+    int rc = 0;
+    int i  = 0;
+    
+    while (i <= m_size)
+    {
+        if (i < m_size && !(m_flags[i] & I2C_REG_DIRTY))
+        {
+            i++;
+            continue;
+        }
+        
+        if (i < m_size)
+        {   // Gather a run of dirty registers into one burst
+            int len = 0;
+            while (i + len < m_size && len < m_maxBurst && (m_flags[i + len] & I2C_REG_DIRTY))
+                len++;
+            
+            m_bus.setBatchEntry(entry[n++], m_adr, m_base + i, &m_shadow[i], len, 0);
+            i += len;
+            
+            if (n < I2C_REGCACHE_BATCH)
+                continue;
+        }
+        else
+            i++;                            // Past the end, send what's left
+        
+        if (n == 0)
+            continue;
+        
+        int handle = m_bus.batchAsync(entry, n);
+        if (handle < 0)
+        {   // Never posted: the entries still read OK, so keep the lot dirty
+            rc = -1;
+            n  = 0;
+            continue;
+        }
+        m_bus.wait(handle);
+        
+        for (int e = 0; e < n; e++)
+        {
+            if (entry[e].sts != I2C_OK)
+            {
+                rc = -1;
+                continue;
+            }
+            
+            int r = entry[e].buffer - m_shadow;
+            for (int k = 0; k < entry[e].count; k++)
+                m_flags[r + k] &= ~I2C_REG_DIRTY;
+        }
+        n = 0;
+    }
+    
+    return rc;
+}
+
+
+/** @brief Read a run of registers from the device into the cache.
+ *
+ *  Pending writes are flushed first so they are not lost.
+ *
+ *  @param int32_t reg: First register address
+ *  @param int count: Number of registers (1-255)
+ *  @return int: 0 on success, -1 on bus error or if any register is not cached
+ */
+int I2CRegCache::load(int32_t reg, int count)
+{
+    if (!inRange(reg, count) || count > 255)
+        return -1;
+    
+    int first = reg - m_base;
+    
+    for (int i = first; i < first + count; i++)
+        if (m_flags[i] & I2C_REG_DIRTY)
+        {
+            if (flush() != 0)
+                return -1;
+            break;
+        }
+    
+    I2C_BATCH_ENTRY entry;
+    m_bus.setBatchEntry(entry, m_adr, reg, &m_shadow[first], count, 1);
+    if (m_bus.batch(&entry, 1) != 0)
+    {
+        invalidate(reg, count);             // Partial data may have landed
+        return -1;
+    }
+    
+    for (int i = first; i < first + count; i++)
+        m_flags[i] |= I2C_REG_VALID;
+    
+    return 0;
+}
+
+
+/** @brief Mark registers as changing on their own (or not).
+ *
+ *  Volatile registers are always read from the device and always written
+ *  when flushed.  Non-volatile registers are read from the cache once known
+ *  and writes of the value they already hold are dropped.
+ *
+ *  @param int32_t reg: First register address
+ *  @param int count: Number of registers
+ *  @param int vol: 1 for volatile, 0 for non-volatile
+ */
+void I2CRegCache::setVolatile(int32_t reg, int count, int vol)
+{
+    if (!inRange(reg, count))
+        return;
+    
+    for (int i = reg - m_base; count > 0; i++, count--)
+    {
+        if (vol)
+            m_flags[i] |= I2C_REG_VOLATILE;
+        else
+            m_flags[i] &= ~I2C_REG_VOLATILE;
+    }
+}
+
+
+/** @brief Forget the cached values of a run of registers.
+ *
+ *  Use after the device has been reset or written behind the cache's back.
+ *  Pending writes to the registers are dropped.
+ *
+ *  @param int32_t reg: First register address
+ *  @param int count: Number of registers
+ */
+void I2CRegCache::invalidate(int32_t reg, int count)
+{
+    if (!inRange(reg, count))
+        return;
+    
+    for (int i = reg - m_base; count > 0; i++, count--)
+        m_flags[i] &= I2C_REG_VOLATILE;
+}
+
+
+/** @brief Forget every cached value and drop all pending writes.
+ */
+void I2CRegCache::invalidate()
+{
+    invalidate(m_base, m_size);
+}
+
+
+/** @brief Limit the length of the bursts flush() sends.
+ *
+ *  For devices that stop auto-incrementing at a boundary, or to bound how 
+ *  long one flush holds the bus.
+ *
+ *  @param int bytes: Largest burst (1-255)
+ */
+void I2CRegCache::setMaxBurst(int bytes)
+{
+    if (bytes < 1)
+        bytes = 1;
+    if (bytes > 255)
+        bytes = 255;
+    
+    m_maxBurst = bytes;
+}
+
+
+/** @brief Check for writes that have not been flushed.
+ *
+ *  @return int: 1 if any register is waiting to be sent, 0 if not
+ */
+int I2CRegCache::isDirty()
+{
+    for (int i = 0; i < m_size; i++)
+        if (m_flags[i] & I2C_REG_DIRTY)
+            return 1;
+    
+    return 0;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Private Members
+//
+
+int I2CRegCache::inRange(int32_t reg, int count)
+{
+    return count > 0 && reg >= m_base && reg - m_base + count <= m_size;
+}
+
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
@@ -0,0 +1,86 @@
+#ifndef __I2C_REGCACHE_H__
+#define __I2C_REGCACHE_H__
+
+#include "i2c.h"
+
+#define I2C_REGCACHE_BATCH  8           // Bursts sent per batch command by flush()
+
+// Per register state bits
+enum I2C_REG_FLAGS
+{
+    I2C_REG_VALID    = 1,       // Shadow holds the device's value
+    I2C_REG_DIRTY    = 2,       // Shadow written but not yet sent
+    I2C_REG_VOLATILE = 4        // Device may change the register on its own
+};
+
+
+/** @brief Register shadow cache for one device on an I2C bus.
+ *
+ *  Keeps a copy of a block of byte wide registers in hub RAM.  write() only 
+ *  updates the copy; flush() sends every changed register, merging runs of
+ *  adjacent registers into single auto-increment bursts and all the bursts 
+ *  into one batch command.  Writing a value the register is known to hold 
+ *  already costs nothing.  read() of a non-volatile register is answered 
+ *  from the copy once it has been read or written.
+ *
+ *  Registers start out volatile, which keeps reads and write skipping safe 
+ *  for status and data registers.  Mark configuration registers non-volatile
+ *  with setVolatile() to get the full benefit.  The device must auto-increment
+ *  its register pointer across each run that is flushed or loaded together.
+ */
+class I2CRegCache
+{
+public:
+    I2CRegCache(I2C& bus, uint8_t adr, int size = 256, int32_t base = 0);
+    ~I2CRegCache();
+    
+    int         write(int32_t reg, uint8_t val);
+    int         write(int32_t reg, uint8_t* bytes, int count);
+    int         read(int32_t reg, uint8_t* val);
+    int         read(int32_t reg, uint8_t* bytes, int count);
+    int         flush();
+    int         load(int32_t reg, int count);
+    
+    void        setVolatile(int32_t reg, int count, int vol = 1);
+    void        invalidate(int32_t reg, int count);
+    void        invalidate();
+    void        setMaxBurst(int bytes);
+    int         isDirty();
+    
+protected:
+    I2C&        m_bus;
+    uint8_t     m_adr;          // 7 bit device address
+    int32_t     m_base;         // Register address of m_shadow[0]
+    int         m_size;         // Registers covered
+    int         m_maxBurst;     // Largest single burst flush() will send
+    uint8_t*    m_shadow;       // Register values
+    uint8_t*    m_flags;        // I2C_REG_FLAGS per register
+    
+private:
+    int         inRange(int32_t reg, int count);
+};
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
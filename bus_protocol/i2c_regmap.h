@@ -0,0 +1,152 @@
+#ifndef __I2C_REGMAP_H__
+#define __I2C_REGMAP_H__
+
+#include "i2c.h"
+
+// What a register allows
+enum I2C_REG_ACCESS
+{
+    I2C_REG_RO = 1,             // Read only
+    I2C_REG_WO = 2,             // Write only
+    I2C_REG_RW = 3              // Read and write
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// I2CPacker - Moves a value of type T to and from its wire bytes.  The byte
+//             positions are worked out per specialization, so pack() and 
+//             unpack() compile down to straight shifts and stores.
+//
+template <typename T, I2C_REG_ORDER Order = I2C_REG_MSB_FIRST, int N = sizeof(T)>
+struct I2CPacker
+{
+    static_assert(sizeof(T) <= 4, "register values are at most 32 bits");
+    
+    // Shift of the value that lands in wire byte [i]
+    static constexpr int shift(int i) 
+    { 
+        return (Order == I2C_REG_MSB_FIRST ? (int)sizeof(T) - 1 - i : i) << 3; 
+    }
+    
+    static void pack(uint8_t* bytes, T val)
+    {
+        bytes[N - 1] = (uint8_t)((uint32_t)val >> shift(N - 1));
+        I2CPacker<T, Order, N - 1>::pack(bytes, val);
+    }
+    
+    static T unpack(const uint8_t* bytes)
+    {
+        return (T)(((uint32_t)bytes[N - 1] << shift(N - 1)) | 
+                   (uint32_t)I2CPacker<T, Order, N - 1>::unpack(bytes));
+    }
+};
+
+template <typename T, I2C_REG_ORDER Order>
+struct I2CPacker<T, Order, 0>
+{
+    static void pack(uint8_t*, T) {}
+    static T    unpack(const uint8_t*) { return 0; }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+// I2CReg - Compile time description of one device register.  Give each 
+//          register of a device a typedef:
+//
+//              typedef I2CReg<0x20, 1, uint8_t>                         CTRL1;
+//              typedef I2CReg<0x28, 1, int16_t, I2C_REG_LSB_FIRST, 
+//                             I2C_REG_RO>                               OUT_X;
+//
+template <uint32_t Addr, int AddrBytes, typename T, 
+          I2C_REG_ORDER Order = I2C_REG_MSB_FIRST, I2C_REG_ACCESS Access = I2C_REG_RW>
+struct I2CReg
+{
+    static_assert(AddrBytes >= 0 && AddrBytes <= 4, "register address is 0-4 bytes");
+    static_assert(AddrBytes == 4 || (Addr >> (AddrBytes << 3)) == 0, 
+                  "register address does not fit its width");
+    
+    typedef T                       value_type;
+    typedef I2CPacker<T, Order>     packer;
+    
+    static constexpr uint32_t       address   = Addr;
+    static constexpr int            addrBytes = AddrBytes;
+    static constexpr int            size      = sizeof(T);
+    static constexpr I2C_REG_ACCESS access    = Access;
+};
+
+
+/** @brief Typed register access to one device on an I2C bus.
+ *
+ *  Reads and writes registers described by I2CReg typedefs.  The register
+ *  address width, value size and byte order all come from the typedef, so 
+ *  nothing is worked out at run time, and writing a read only register or
+ *  reading a write only one does not compile.
+ *
+ *      I2CRegDevice accel(bus, 0x1D);
+ *      accel.write<CTRL1>(0x57);
+ *      int16_t x;
+ *      accel.read<OUT_X>(x);
+ *
+ *  The device is driven through a proxy handle on [bus], so the bus needs a
+ *  hardware lock and its own address and settings are left alone.
+ */
+class I2CRegDevice
+{
+public:
+    I2CRegDevice(I2C& bus, uint8_t adr) : m_dev(bus) { m_dev.openBus(adr); };
+    
+    int isReady() { return m_dev.isReady(); };
+    
+    template <class Reg> 
+    int read(typename Reg::value_type& val)
+    {
+        static_assert(Reg::access & I2C_REG_RO, "register is write only");
+        
+        uint8_t bytes[Reg::size];
+        
+        if (m_dev.rxReg(Reg::address, Reg::addrBytes, bytes, Reg::size) != 0)
+            return -1;
+        
+        val = Reg::packer::unpack(bytes);
+        return 0;
+    };
+    
+    template <class Reg> 
+    int write(typename Reg::value_type val)
+    {
+        static_assert(Reg::access & I2C_REG_WO, "register is read only");
+        
+        uint8_t bytes[Reg::size];
+        
+        Reg::packer::pack(bytes, val);
+        return m_dev.txReg(Reg::address, Reg::addrBytes, bytes, Reg::size);
+    };
+    
+protected:
+    I2C         m_dev;          // Proxy handle on the caller's bus
+};
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
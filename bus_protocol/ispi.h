@@ -29,10 +29,28 @@ public:
     virtual int setBPW(int val)=0;
     virtual int setSpeed(int val) = 0;
     virtual int setMode(int val) = 0;
+    int         getBPW() { return m_spiBPW; };
     
+    // Full duplex transfer of [len] bytes in place, returns 0 on success or
+    // a negative error (-1, ERR_SPI_NOT_IMPL) on failure.
     virtual int      rwData(uint8_t *data, uint8_t len)=0;
     virtual uint8_t  rwByte(uint8_t bt)=0;
     virtual uint16_t rwWord(uint16_t wd)=0;
+    
+    // Optional override: [len] bytes as back to back CS frames of [frame] bytes,
+    // e.g. one byte per chained device.  Override to do it in one transaction.
+    // Returns 0 on success or -1 if the arguments or any frame failed.
+    virtual int rwFrames(uint8_t *data, int len, int frame)
+    {
+        if (frame < 1 || frame > 255 || len % frame)
+            return -1;
+        
+        for (int i = 0; i < len; i += frame)
+            if (rwData(data + i, frame) < 0)
+                return -1;
+        
+        return 0;
+    };
 };
 
 /*
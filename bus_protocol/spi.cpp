@@ -0,0 +1,463 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spi.h"
+
+extern uint32_t _load_start_SPIDriver_cog[];
+extern uint32_t _load_stop_SPIDriver_cog[];
+
+#define SPI_YIELD_USEC      30          // usleep interval for YIELD polling
+
+
+/** @brief Start an SPI bus on a cog of its own.
+ *
+ *  @param int mosi: MOSI pin
+ *  @param int miso: MISO pin
+ *  @param int sck: SCLK pin
+ *  @param int cs: Chip select pin, driven low for each transfer
+ *  @param int speed: SCLK frequency in Hz (see setSpeed()), out of range
+ *                    rates start at the top rate
+ *  @param int mode: SPI mode 0-3
+ */
+SPI::SPI(int mosi, int miso, int sck, int cs, int speed, int mode)
+{
+    m_ready    = 0;
+    m_open     = 0;
+    m_owner    = 1;
+    m_lastSts  = SPI_OK;
+    m_csMask   = 1 << cs;
+    m_spiBPW   = 8;
+    m_spiMode  = mode & 3;
+    m_waitMode = SPI_WAIT_SPIN;
+    if (setSpeed(speed) != 0)
+        setSpeed(CLKFREQ / (2 * SPI_MIN_HALF));
+    
+    m_bus = (SPI_PAR *) malloc(sizeof(SPI_PAR));
+    if (m_bus == 0)
+        return;
+    
+    m_bus->cog          = -1;
+    m_bus->init.mosi    = mosi;
+    m_bus->init.miso    = miso;
+    m_bus->init.sck     = sck;
+    m_bus->init.cs      = cs;
+    m_bus->init.mode    = m_spiMode;
+    m_bus->init.mailbox = m_bus->ring;
+    m_bus->init.tail    = &m_bus->tail;
+    m_bus->head         = 0;
+    m_bus->tail         = 0;
+    m_bus->lock         = locknew();    // -1 leaves a single producer only
+    
+    for (int i = 0; i < SPI_RING_SIZE; i++)
+        m_bus->ring[i].cmd = SPI_CMD_IDLE;
+    m_bus->ring[0].cmd  = SPI_CMD_INIT;
+    
+    // Start the COG according to the method needed for LMM/XMM memory models
+    #if defined(__PROPELLER_XMMC__) || defined(__PROPELLER_XMM__)
+        int size = _load_stop_SPIDriver_cog - _load_start_SPIDriver_cog;
+        unsigned int cogbuffer[size];
+        memcpy(cogbuffer, _load_start_SPIDriver_cog, size<<2);
+    #else
+        int *cogbuffer = (int*)_load_start_SPIDriver_cog;
+    #endif
+    
+    m_bus->cog = cognew(cogbuffer, &m_bus->init);
+    if (m_bus->cog < 0)
+        return;
+    
+    uint32_t start = CNT;
+    while (m_bus->ring[0].cmd != SPI_CMD_IDLE)
+        if (CNT - start > (CLKFREQ >> SPI_INIT_WAIT_SHIFT))
+            return;
+    
+    m_ready = 1;
+}
+
+
+/** @brief Make a handle for another device on an already started bus.
+ *
+ *  The handle is the device's descriptor: it keeps its own CS pin, speed,
+ *  mode and word width, and its commands go into the shared ring with them.
+ *  The cog only reconfigures when consecutive commands differ, so traffic
+ *  for several devices posted with transferAsync() runs back to back 
+ *  without a setSpeed()/setMode() round before each call.  Producers are
+ *  serialized with the bus's hardware lock, so a bus that could not get a
+ *  lock cannot be shared.  The original [bus] object must outlive it.
+ *
+ *  @param SPI& bus: Bus to share
+ *  @param int cs: Chip select pin of the device
+ *  @param int speed: SCLK frequency in Hz (see setSpeed()), out of range
+ *                    rates start at the top rate
+ *  @param int mode: SPI mode 0-3
+ *  @param int bpw: Bits per word (1-SPI_BPW_MAX)
+ */
+SPI::SPI(SPI& bus, int cs, int speed, int mode, int bpw)
+{
+    m_bus      = bus.m_bus;
+    m_owner    = 0;
+    m_open     = 0;
+    m_lastSts  = SPI_OK;
+    m_csMask   = 1 << cs;
+    m_spiBPW   = 8;
+    m_spiMode  = mode & 3;
+    m_waitMode = bus.m_waitMode;
+    m_ready    = bus.m_ready && m_bus->lock >= 0;
+    if (setSpeed(speed) != 0)
+        setSpeed(CLKFREQ / (2 * SPI_MIN_HALF));
+    setBPW(bpw);
+}
+
+
+SPI::~SPI()
+{
+    if (!m_owner || m_bus == 0)
+        return;                         // Proxies leave the bus to its owner
+    
+    if (m_bus->cog >= 0)
+        cogstop(m_bus->cog);
+    if (m_bus->lock >= 0)
+        lockret(m_bus->lock);
+    
+    free(m_bus);
+    m_bus   = 0;
+    m_ready = 0;
+}
+
+
+/** @brief Start using the bus.  A device handle has the cog take its CS pin.
+ *
+ *  @return int: 0 on success, -1 if the bus is not ready
+ */
+int SPI::openBus()
+{
+    m_open = 1;
+    if (m_owner)
+        return 0;
+    
+    // Drive the device's CS high now rather than on its first transfer
+    if (wait(submit(SPI_CMD_CLAIM, 0, 0, 8, 0)) != 0)
+    {
+        m_open = 0;
+        return -1;
+    }
+    return 0;
+}
+
+
+int SPI::closeBus()
+{
+    m_open = 0;
+    return 0;
+}
+
+
+int SPI::isReady()
+{
+    return (m_ready && m_open) ? 1 : 0;
+}
+
+
+int SPI::getCog()
+{
+    return m_bus ? m_bus->cog : -1;
+}
+
+
+int SPI::getStatus()
+{   // Status of the last command waited on
+    return m_lastSts;
+}
+
+
+/** @brief Set the word width for rwData() and transfer().
+ *
+ *  @param int val: Bits per word (1-SPI_BPW_MAX)
+ *  @return int: 0 on success, -1 if out of range
+ */
+int SPI::setBPW(int val)
+{
+    if (val < 1 || val > SPI_BPW_MAX)
+        return -1;
+    
+    m_spiBPW = val;
+    return 0;
+}
+
+
+/** @brief Set the SCLK frequency for following transfers.
+ *
+ *  Each half cycle is timed to the tick against waitcnt, and never shorter
+ *  than asked for.  The paced bit loop holds half cycles of SPI_MIN_HALF
+ *  ticks and up, so the top rate is CLKFREQ / (2 * SPI_MIN_HALF): 1MHz at 
+ *  80MHz.  Faster rates are refused rather than run off-spec.
+ *
+ *  @param int val: Frequency in Hz (1-CLKFREQ / (2 * SPI_MIN_HALF))
+ *  @return int: 0 on success, -1 if out of range
+ */
+int SPI::setSpeed(int val)
+{
+    if (val <= 0 || (uint32_t)val > CLKFREQ / (2 * SPI_MIN_HALF))
+        return -1;
+    
+    m_speed     = val;
+    m_halfCycle = (CLKFREQ / 2 + val - 1) / val;
+    return 0;
+}
+
+
+/** @brief Set the SPI mode for following transfers.
+ *
+ *  @param int val: 0-3, SPI_CPOL and SPI_CPHA combined
+ *  @return int: 0 on success, -1 if out of range
+ */
+int SPI::setMode(int val)
+{
+    if (val < 0 || val > 3)
+        return -1;
+    
+    m_spiMode = val;
+    return 0;
+}
+
+
+/** @brief Full duplex transfer of up to 255 bytes, received bytes replace [data].
+ *
+ *  @param uint8_t* data: Words to send, overwritten with the words received
+ *  @param uint8_t len: Length of [data] in bytes, a whole number of words
+ *  @return int: 0 on success, -1 on error
+ */
+int SPI::rwData(uint8_t *data, uint8_t len)
+{
+    int nbytes = (m_spiBPW + 7) >> 3;
+    
+    if (len % nbytes)
+        return -1;
+    
+    return transfer(data, len / nbytes);
+}
+
+
+uint8_t SPI::rwByte(uint8_t bt)
+{
+    if (wait(submit(SPI_CMD_TRANSFER, &bt, 1, 8, 0)) != 0)
+        return 0xFF;
+    
+    return bt;
+}
+
+
+uint16_t SPI::rwWord(uint16_t wd)
+{
+    uint8_t bytes[2];
+    
+    bytes[0] = wd >> 8;
+    bytes[1] = wd;
+    if (wait(submit(SPI_CMD_TRANSFER, bytes, 1, 16, 0)) != 0)
+        return 0xFFFF;
+    
+    return (bytes[0] << 8) | bytes[1];
+}
+
+
+/** @brief Full duplex transfer of any number of words in one CS frame.
+ *
+ *  @param uint8_t* data: Words to send, overwritten with the words received
+ *  @param int words: Number of words (0-SPI_COUNT_MAX)
+ *  @return int: 0 on success, -1 on error
+ */
+int SPI::transfer(uint8_t *data, int words)
+{
+    return wait(transferAsync(data, words));
+}
+
+
+/** @brief Post a transfer to the cog and return without waiting.
+ *
+ *  [data] is read and written by the cog until the handle completes.
+ *
+ *  @param uint8_t* data: Words to send, overwritten with the words received
+ *  @param int words: Number of words (0-SPI_COUNT_MAX)
+ *  @return int: Transfer handle, or -1 on error
+ */
+int SPI::transferAsync(uint8_t *data, int words)
+{
+    return submit(SPI_CMD_TRANSFER, data, words, m_spiBPW, 0);
+}
+
+
+/** @brief Post a streaming transfer over a double buffered ring.
+ *
+ *  The cog holds CS low and clocks [s] half by half until it is ended, so 
+ *  it blocks the ring for every other command until then.  See SPIStream 
+ *  for the producer side.
+ *
+ *  @param SPI_STREAM* s: Stream control block, live until the handle completes
+ *  @return int: Transfer handle, or -1 on error
+ */
+int SPI::stream(SPI_STREAM *s)
+{
+    if (s == 0)
+        return -1;
+    
+    return submit(SPI_CMD_STREAM, (uint8_t *)s, 0, 8, 0);
+}
+
+
+/** @brief Transfer a buffer as back to back CS frames in one command.
+ *
+ *  The cog raises CS for SPI_CS_GAP ticks after every [frame] bytes, so a
+ *  daisy chain of parts that latch on each CS rise, like the L6470, gets a
+ *  whole multi-byte chain update in one transaction.
+ *
+ *  @param uint8_t* data: Words to send, overwritten with the words received
+ *  @param int len: Length of [data] in bytes
+ *  @param int frame: Bytes per CS frame, both a whole number of words
+ *  @return int: 0 on success, -1 on error
+ */
+int SPI::rwFrames(uint8_t *data, int len, int frame)
+{
+    int nbytes = (m_spiBPW + 7) >> 3;
+    
+    if (frame < 1 || len % frame || frame % nbytes)
+        return -1;
+    
+    return wait(submit(SPI_CMD_TRANSFER, data, len / nbytes, m_spiBPW, frame / nbytes));
+}
+
+
+int SPI::isDone(int handle)
+{
+    if (handle < 0)
+        return 1;
+    
+    // Compare on 31 bits so the running counter can wrap safely
+    uint32_t ahead = (m_bus->tail - (uint32_t)handle) & 0x7FFFFFFF;
+    return ahead < 0x40000000 ? 1 : 0;
+}
+
+
+/** @brief Block until a posted transfer finishes.
+ *
+ *  The status is kept in the transfer's ring slot, so it can only be read
+ *  until SPI_RING_SIZE further transfers have been posted, by this handle
+ *  or any other device on the bus.  A handle waited on later than that fails
+ *  with getStatus() returning SPI_ERR_EXPIRED.
+ *
+ *  @param int handle: Handle returned by transferAsync()
+ *  @return int: 0 on success, -1 on error, expired or invalid handle
+ */
+int SPI::wait(int handle)
+{
+    if (handle < 0)
+        return -1;
+    
+    volatile SPI_MAILBOX *slot = &m_bus->ring[(handle - 1) & (SPI_RING_SIZE - 1)];
+    
+    while (!isDone(handle))
+        pollDelay();
+    
+    uint32_t sts = slot->sts;
+    
+    // A producer claims the slot by writing seq before anything else, and the
+    // cog only rewrites sts after that, so an unchanged seq vouches for sts
+    if (slot->seq != (uint32_t)handle)
+    {
+        m_lastSts = SPI_ERR_EXPIRED;
+        return -1;
+    }
+    
+    m_lastSts = sts;
+    return m_lastSts == SPI_OK ? 0 : -1;
+}
+
+
+/** @brief Select how the calling cog waits on the SPI cog.
+ *
+ *  @param SPI_WAIT mode: Wait strategy to use
+ */
+void SPI::setWaitStrategy(SPI_WAIT mode)
+{
+    m_waitMode = mode;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Private Members
+//
+
+void SPI::lockBus()
+{
+    if (m_bus->lock >= 0)
+        while (lockset(m_bus->lock))
+            ;
+}
+
+
+void SPI::unlockBus()
+{
+    if (m_bus->lock >= 0)
+        lockclr(m_bus->lock);
+}
+
+
+void SPI::pollDelay()
+{
+    if (m_waitMode == SPI_WAIT_YIELD)
+        usleep(SPI_YIELD_USEC);
+}
+
+
+int SPI::submit(SPI_CMD cmd, uint8_t *buf, int count, int bpw, int frame)
+{
+    if (!isReady() || count < 0 || count > SPI_COUNT_MAX)
+        return -1;
+    
+    lockBus();
+    
+    // Wait for a free slot if the cog is a full ring behind
+    while (m_bus->head - m_bus->tail >= SPI_RING_SIZE)
+        pollDelay();
+    
+    int handle = (int)((m_bus->head + 1) & 0x7FFFFFFF);
+    
+    volatile SPI_MAILBOX *slot = &m_bus->ring[m_bus->head & (SPI_RING_SIZE - 1)];
+    slot->seq        = handle;          // Earlier waiters on the slot see it is gone
+    slot->buffer     = buf;
+    slot->count      = count;
+    slot->bpw        = bpw;
+    slot->mode       = m_spiMode;
+    slot->frame      = frame;
+    slot->cs         = m_csMask;
+    slot->half_cycle = m_halfCycle;
+    slot->cmd        = cmd;             // Cog picks the slot up from here
+    m_bus->head++;
+    
+    unlockBus();
+    return handle;
+}
+
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
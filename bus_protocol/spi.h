@@ -0,0 +1,102 @@
+#ifndef __SPI_H__
+#define __SPI_H__
+
+#include "ispi.h"
+#include "spi_driver.h"
+
+// Ways for the calling cog to wait on the SPI cog
+enum SPI_WAIT
+{
+    SPI_WAIT_SPIN,          // Poll the hub continuously
+    SPI_WAIT_YIELD          // usleep between polls to let other threads run
+};
+
+
+/** @brief SPI master on a dedicated cog.
+ *
+ *  Implements ISPI with the driver in spi_driver.cogc.  Each rwData() or
+ *  transfer() call is one command in the cog's ring.  The cog clocks the
+ *  whole buffer with CS held low and writes back the received words in
+ *  place, with no handshake per byte.  Transfers can also be posted with
+ *  transferAsync() and collected with isDone()/wait().
+ *
+ *  Several devices share one bus through device handles (the SPI(SPI&, ...)
+ *  constructor), each carrying its own CS pin, speed, mode and word width.
+ *
+ *  Words are setBPW() bits wide, 8 by default.  In the buffer each word takes
+ *  (bpw + 7) / 8 bytes, big endian, so bytes are words at the default width.
+ *  rwByte() and rwWord() always move 8 and 16 bits.
+ */
+class SPI : public ISPI
+{
+protected:
+    SPI_PAR*    m_bus;          // Hub side of the bus, allocated by the owning handle
+    int         m_owner;        // 1 for the handle that started the bus, 0 for devices
+    int         m_ready;
+    int         m_open;         // openBus() called
+    int         m_lastSts;      // Result of the last command waited on
+    uint32_t    m_halfCycle;    // SCLK half cycle in ticks
+    uint32_t    m_csMask;       // Chip select pin mask
+    SPI_WAIT    m_waitMode;
+    
+public:
+    SPI(int mosi, int miso, int sck, int cs, int speed = 1000000, int mode = 0);
+    SPI(SPI& bus, int cs, int speed = 1000000, int mode = 0, int bpw = 8);
+    ~SPI();
+    
+    int         openBus();
+    int         closeBus();
+    int         isReady();
+    int         setBPW(int val);
+    int         setSpeed(int val);
+    int         setMode(int val);
+    
+    int         rwData(uint8_t *data, uint8_t len);
+    uint8_t     rwByte(uint8_t bt);
+    uint16_t    rwWord(uint16_t wd);
+    int         rwFrames(uint8_t *data, int len, int frame);
+    
+    int         transfer(uint8_t *data, int words);
+    int         transferAsync(uint8_t *data, int words);
+    int         stream(SPI_STREAM *s);
+    int         isDone(int handle);
+    int         wait(int handle);
+    
+    int         getCog();
+    int         getStatus();
+    void        setWaitStrategy(SPI_WAIT mode);
+    
+private:
+    SPI(const SPI&);
+    SPI& operator=(const SPI&);         // Not assignable, use a device handle
+    
+    void        lockBus();
+    void        unlockBus();
+    void        pollDelay();
+    int         submit(SPI_CMD cmd, uint8_t *buf, int count, int bpw, int frame);
+};
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <string.h>
+#include "spi_chain.h"
+
+
+/** @brief Attach to a chain of devices on an open bus.
+ *
+ *  @param ISPI& bus: Bus the chain is on, must outlive this object
+ *  @param int devices: Number of devices in the chain (1-SPI_CHAIN_MAX)
+ *  @param int maxLen: Longest command or response of one device in bytes
+ *  @param uint8_t nop: Byte that makes a device do nothing, 0x00 on the L6470
+ *  @param int csPerByte: 1 to raise CS after every byte position, 0 for one frame
+ */
+SPIChain::SPIChain(ISPI& bus, int devices, int maxLen, uint8_t nop, int csPerByte) 
+    : m_bus(bus)
+{
+    m_devices   = devices;
+    m_maxLen    = maxLen;
+    m_nop       = nop;
+    m_csPerByte = csPerByte;
+    m_frame     = 0;
+    
+    if (devices >= 1 && devices <= SPI_CHAIN_MAX && maxLen >= 1)
+        m_frame = (uint8_t*)malloc(devices * maxLen);
+}
+
+
+SPIChain::~SPIChain()
+{
+    free(m_frame);
+}
+
+
+/** @brief Check that the bus can be used and the chain is set up.
+ *
+ *  @return int: 1 if ready, 0 if not
+ */
+int SPIChain::isReady()
+{
+    return (m_frame != 0 && m_bus.isReady()) ? 1 : 0;
+}
+
+
+int SPIChain::getDevices()
+{
+    return m_devices;
+}
+
+
+/** @brief Send every device a command of the same length in one transaction.
+ *
+ *  @param uint8_t* data: [len] bytes for device 0, then device 1 and so on,
+ *                        overwritten with each device's response
+ *  @param int len: Bytes per device (1-maxLen)
+ *  @return int: 0 on success, -1 on error
+ */
+int SPIChain::exchange(uint8_t* data, int len)
+{
+    if (m_frame == 0 || len < 1 || len > m_maxLen)
+        return -1;
+    
+    for (int i = 0; i < len; i++)
+        for (int d = 0; d < m_devices; d++)
+            m_frame[i * m_devices + m_devices - 1 - d] = data[d * len + i];
+    
+    if (clock(len) != 0)
+        return -1;
+    
+    for (int i = 0; i < len; i++)
+        for (int d = 0; d < m_devices; d++)
+            data[d * len + i] = m_frame[i * m_devices + m_devices - 1 - d];
+    
+    return 0;
+}
+
+
+/** @brief Send each device its own command in one transaction.
+ *
+ *  Byte positions past a device's command carry the NOP byte, and the 
+ *  response is only written back over the device's own [lens[d]] bytes.
+ *
+ *  @param uint8_t** cmds: One buffer per device, 0 for a device left alone,
+ *                         overwritten with its response
+ *  @param const int* lens: Bytes in each buffer (0-maxLen)
+ *  @return int: 0 on success, -1 on error
+ */
+int SPIChain::exchange(uint8_t** cmds, const int* lens)
+{
+    int len = 0;
+    
+    if (m_frame == 0)
+        return -1;
+    
+    for (int d = 0; d < m_devices; d++)
+    {
+        if (lens[d] < 0 || lens[d] > m_maxLen || (lens[d] > 0 && cmds[d] == 0))
+            return -1;
+        if (lens[d] > len)
+            len = lens[d];
+    }
+    
+    if (len == 0)
+        return 0;
+    
+    for (int i = 0; i < len; i++)
+        for (int d = 0; d < m_devices; d++)
+            m_frame[i * m_devices + m_devices - 1 - d] = i < lens[d] ? cmds[d][i] : m_nop;
+    
+    if (clock(len) != 0)
+        return -1;
+    
+    for (int i = 0; i < len; i++)
+        for (int d = 0; d < m_devices; d++)
+            if (i < lens[d])
+                cmds[d][i] = m_frame[i * m_devices + m_devices - 1 - d];
+    
+    return 0;
+}
+
+
+/** @brief Talk to one device, sending NOPs to the rest of the chain.
+ *
+ *  @param int dev: Chain position, 0 nearest the master's MOSI
+ *  @param uint8_t* data: Command, overwritten with the response
+ *  @param int len: Bytes in [data] (1-maxLen)
+ *  @return int: 0 on success, -1 on error
+ */
+int SPIChain::exchangeOne(int dev, uint8_t* data, int len)
+{
+    uint8_t* cmds[SPI_CHAIN_MAX] = { 0 };
+    int      lens[SPI_CHAIN_MAX] = { 0 };
+    
+    if (dev < 0 || dev >= m_devices)
+        return -1;
+    
+    cmds[dev] = data;
+    lens[dev] = len;
+    return exchange(cmds, lens);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Private Members
+//
+
+int SPIChain::clock(int len)
+{/* Clock [len] byte positions of the interleaved buffer */
+    
+    int total = len * m_devices;
+    int bpw   = m_bus.getBPW();             // Other users of the bus keep their width
+    int rc;
+    
+    if (m_bus.setBPW(8) != 0)
+        return -1;
+    
+    rc = m_bus.rwFrames(m_frame, total, m_csPerByte ? m_devices : total);
+    m_bus.setBPW(bpw);
+    return rc;
+}
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
@@ -0,0 +1,75 @@
+#ifndef __SPI_CHAIN_H__
+#define __SPI_CHAIN_H__
+
+#include "ispi.h"
+
+#define SPI_CHAIN_MAX   8       // Most devices in one chain
+
+
+/** @brief Devices daisy chained on one CS line, like several L6470 drivers.
+ *
+ *  The master's MOSI feeds device 0 and the last device's SDO comes back on
+ *  MISO, so in a frame of one byte per device the first byte clocked out 
+ *  ends up in the last device, and the first byte clocked in came from it.
+ *  exchange() interleaves the commands of every device into one buffer in
+ *  that order, clocks it with a single rwFrames() call and sorts the 
+ *  responses back out per device.  Devices with shorter commands are padded
+ *  with the NOP byte, so one device can be polled while another is moved.
+ *
+ *  With [csPerByte] set the chain is given one CS frame per byte position,
+ *  as the L6470 wants.  Otherwise the whole update is a single frame, as for
+ *  plain shift registers.  The bus is used at 8 bits per word for the 
+ *  chain transfer and put back to its previous width afterwards.
+ */
+class SPIChain
+{
+public:
+    SPIChain(ISPI& bus, int devices, int maxLen = 4, uint8_t nop = 0x00, int csPerByte = 1);
+    ~SPIChain();
+    
+    int         isReady();
+    int         getDevices();
+    
+    int         exchange(uint8_t* data, int len);
+    int         exchange(uint8_t** cmds, const int* lens);
+    int         exchangeOne(int dev, uint8_t* data, int len);
+    
+protected:
+    ISPI&       m_bus;
+    int         m_devices;      // Chain length
+    int         m_maxLen;       // Longest command per device in bytes
+    uint8_t     m_nop;          // Byte sent to devices with nothing to say
+    int         m_csPerByte;    // One CS frame per byte position
+    uint8_t*    m_frame;        // Interleaved buffer, [m_devices * m_maxLen] bytes
+    
+private:
+    SPIChain(const SPIChain&);
+    SPIChain& operator=(const SPIChain&);
+    
+    int         clock(int len);
+};
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
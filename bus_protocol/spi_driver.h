@@ -0,0 +1,149 @@
+/* 
+ * Definitions for supporting data structures to the SPI COGC driver.
+ */
+
+#ifndef __SPI_DRIVER_H__
+#define __SPI_DRIVER_H__
+
+#include <propeller.h>
+
+#define SPI_RING_SIZE   8       // Mailbox slots in the command ring (power of 2)
+#define SPI_MIN_HALF    40      // Shortest half cycle the waitcnt paced bit loop holds, 1MHz SCLK at 80MHz
+#define SPI_COUNT_MAX   65535   // Largest single transfer in words
+#define SPI_BPW_MAX     32      // Widest word
+#define SPI_CS_GAP      80      // Ticks CS is held high between frames (1us at 80MHz)
+#ifndef SPI_INIT_WAIT_SHIFT
+#define SPI_INIT_WAIT_SHIFT 8   // Give a new cog CLKFREQ >> 8 (~3.9ms) to set up the pins
+#endif
+
+// SPI modes, CPOL is bit 1 and CPHA bit 0
+#define SPI_CPHA        1       // Sample on the trailing edge
+#define SPI_CPOL        2       // SCLK idles high
+
+// SPI Commands
+typedef enum SPI_CMD
+{
+    SPI_CMD_IDLE,           // Bus quiet and ready for new command
+    SPI_CMD_INIT,           // Initialize the bus
+    SPI_CMD_LOCKED,         // Marks the slot as claimed but not yet filled
+    SPI_CMD_TRANSFER,       // Clock [count] words out of and back into buffer
+    SPI_CMD_STREAM,         // Clock the SPI_STREAM at buffer until it is ended
+    SPI_CMD_CLAIM           // Take the slot's CS pin and drive it high
+} SPI_CMD;
+
+
+// SPI status return types
+typedef enum SPI_RESULT
+{
+    SPI_OK = 0,             // Transfer completed
+    SPI_ERR_UNKNOWN_CMD,    // Last command was not valid
+    SPI_ERR_EXPIRED         // The handle's ring slot was reused before its status was read
+} SPI_RESULT;
+
+
+///////////////////////////////////////////////////////////////////////////////////////
+// SPI_MAILBOX structure - 	One command for the SPI cog.  A transfer is full duplex:
+//							each word of buffer is sent MSB first and replaced by the
+//							word received with it.  A word takes (bpw + 7) / 8 bytes,
+//							big endian and right aligned.  The settings travel with
+//							every command, CS pin included; the cog only touches the
+//							pins when they differ from the last command's.  With frame set, CS is 
+//							raised for SPI_CS_GAP ticks after every [frame] words, so
+//							a daisy chain wanting one CS frame per byte position is 
+//							still a single command.  seq lets a waiter tell its own
+//							command's sts from that of a later one another device
+//							handle has since posted to the slot.
+//
+typedef struct SPI_MAILBOX
+{
+    volatile uint32_t cmd;       // SPI command (SEE SPI_CMD Enum)
+    volatile uint32_t sts;       // Last command status (SEE SPI_RESULT Enum)
+    uint8_t*          buffer;    // Words to send, overwritten with the words received
+    volatile uint16_t count;     // Number of words
+    volatile uint8_t  bpw;       // Bits per word (1-SPI_BPW_MAX)
+    volatile uint8_t  mode;      // SPI mode (0-3)
+    volatile uint16_t frame;     // Words per CS frame, 0 for one frame
+    volatile uint32_t cs;        // Chip select pin mask of the device
+    volatile uint32_t half_cycle;// Ticks per SCLK half cycle (SPI_MIN_HALF or more)
+    volatile uint32_t stamp;     // CNT when the cog retired the command
+    volatile uint32_t seq;       // Handle of the command, written by the producer before cmd
+} SPI_MAILBOX;
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// SPI_STREAM structure -	Double buffered hub ring for SPI_CMD_STREAM.  The producer
+//							fills one half while the cog clocks the other, handing
+//							halves over by bumping filled after setting their word
+//							count.  The cog bumps sent as each half goes out, keeping
+//							CS low throughout, and stops once end is set and every
+//							filled half is sent.  Received bytes replace the sent ones.
+//							Words are 8 bits.
+//
+typedef struct SPI_STREAM
+{
+    uint8_t*          ring;         // Two halves of [half] bytes each
+    uint32_t          half;         // Bytes per half
+    volatile uint32_t words[2];     // Words queued in each half
+    volatile uint32_t filled;       // Halves handed over by the producer
+    volatile uint32_t sent;         // Halves clocked out by the cog
+    volatile uint32_t end;          // Set by the producer after its last half
+    volatile uint32_t underruns;    // Times the cog ran dry before the end
+} SPI_STREAM;
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// SPI_INIT structure -	Initialization parameters passed to the SPI COG.
+//
+typedef struct SPI_INIT
+{
+    volatile SPI_MAILBOX *mailbox;  // Pointer to the first slot of the cog's HUB command ring
+    volatile uint32_t *tail;        // Pointer to the ring's completed command counter
+    uint32_t mosi;                  // MOSI IO Pin
+    uint32_t miso;                  // MISO IO Pin
+    uint32_t sck;                   // SCLK IO Pin
+    uint32_t cs;                    // Chip select IO Pin (active low) of the owning handle
+    uint32_t mode;                  // SPI mode to idle the clock in until the first command
+} SPI_INIT;
+
+
+//////////////////////////////////////////////////////////////////////////////////////
+// SPI_PAR Structure -	Hub side of one SPI bus: the init block, the command ring
+//						and the producer counters.  Works like the I2C PAR_S: the
+//						slot at head is filled under the lock with cmd written last,
+//						and the COG bumps tail after running each slot.
+//
+typedef struct SPI_PAR
+{
+    uint32_t stack[8];		// COG Execution stack
+    SPI_INIT init; 			// COG Initialization Parameters
+    SPI_MAILBOX ring[SPI_RING_SIZE];  // COG Communication mailbox ring
+    volatile uint32_t head;	// Count of commands posted by producers
+    volatile uint32_t tail;	// Count of commands completed by the COG
+    int32_t lock;			// Hardware lock serializing producers (-1 if none)
+    int32_t cog; 			// COG Number used for this bus (if started)
+} SPI_PAR;
+
+
+#endif
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+#include "spi_stream.h"
+
+
+/** @brief Set up a stream ring on an already started bus.
+ *
+ *  @param SPI& bus: Bus to stream on, must outlive this object
+ *  @param int half: Bytes per half of the ring (1-SPI_COUNT_MAX)
+ */
+SPIStream::SPIStream(SPI& bus, int half) : m_bus(bus)
+{
+    memset(&m_stream, 0, sizeof(m_stream));
+    m_handle = -1;
+    m_cur    = 0;
+    m_fill   = 0;
+    m_bytes  = 0;
+    m_stalls = 0;
+    
+    if (half >= 1 && half <= SPI_COUNT_MAX)
+        m_stream.ring = (uint8_t*)malloc(half * 2);
+    if (m_stream.ring)
+        m_stream.half = half;
+}
+
+
+SPIStream::~SPIStream()
+{
+    finish();
+    free(m_stream.ring);
+}
+
+
+/** @brief Post the stream to the cog.  CS goes low and stays low until finish().
+ *
+ *  @return int: 0 on success, -1 if already running or the bus is not ready
+ */
+int SPIStream::start()
+{
+    if (m_stream.ring == 0 || m_handle >= 0)
+        return -1;
+    
+    m_stream.filled    = 0;
+    m_stream.sent      = 0;
+    m_stream.end       = 0;
+    m_stream.underruns = 0;
+    m_cur    = 0;
+    m_fill   = 0;
+    m_bytes  = 0;
+    m_stalls = 0;
+    
+    m_handle = m_bus.stream(&m_stream);
+    return m_handle >= 0 ? 0 : -1;
+}
+
+
+/** @brief Copy data into the ring, handing each half to the cog as it fills.
+ *
+ *  @param const uint8_t* data: Bytes to send
+ *  @param int len: Number of bytes, any length
+ *  @return int: 0 on success, -1 if the stream is not running
+ */
+int SPIStream::write(const uint8_t* data, int len)
+{
+    int n;
+    
+    while (len > 0)
+    {
+        if (m_cur == 0 && (m_cur = nextHalf()) == 0)
+            return -1;
+        
+        n = m_stream.half - m_fill;
+        if (n > len)
+            n = len;
+        
+        memcpy(m_cur + m_fill, data, n);
+        m_fill += n;
+        data   += n;
+        len    -= n;
+        
+        if (m_fill == (int)m_stream.half && flush() != 0)
+            return -1;
+    }
+    
+    return 0;
+}
+
+
+/** @brief Get the next half to fill in place, waiting for the cog to free it.
+ *
+ *  A half left partly filled by write() is handed over first, so the two
+ *  ways of filling can be mixed.
+ *
+ *  @return uint8_t*: [half] bytes to fill before commit(), 0 if not running
+ */
+uint8_t* SPIStream::nextHalf()
+{
+    if (m_handle < 0 || (m_cur && flush() != 0))
+        return 0;
+    
+    if (m_stream.filled - m_stream.sent >= 2)
+    {
+        m_stalls++;
+        while (m_stream.filled - m_stream.sent >= 2)
+            ;
+    }
+    
+    return m_stream.ring + ((m_stream.filled & 1) ? m_stream.half : 0);
+}
+
+
+/** @brief Hand the half from nextHalf() to the cog.
+ *
+ *  @param int len: Bytes filled (1-half)
+ *  @return int: 0 on success, -1 if not running or out of range
+ */
+int SPIStream::commit(int len)
+{
+    if (m_handle < 0 || len < 1 || len > (int)m_stream.half)
+        return -1;
+    
+    m_stream.words[m_stream.filled & 1] = len;
+    m_stream.filled++;                  // Cog picks the half up from here
+    m_bytes += len;
+    return 0;
+}
+
+
+/** @brief Hand over a partly filled half from write() without waiting for more.
+ *
+ *  @return int: 0 on success, -1 if not running
+ */
+int SPIStream::flush()
+{
+    int len = m_fill;
+    
+    if (m_cur == 0 || len == 0)
+        return 0;
+    
+    m_cur  = 0;
+    m_fill = 0;
+    return commit(len);
+}
+
+
+/** @brief Send whatever is left, end the stream and release CS.
+ *
+ *  @return int: 0 on success, -1 on error or if not running
+ */
+int SPIStream::finish()
+{
+    if (m_handle < 0)
+        return -1;
+    
+    int rc = flush();
+    
+    m_stream.end = 1;
+    if (m_bus.wait(m_handle) != 0)
+        rc = -1;
+    
+    m_handle = -1;
+    return rc;
+}
+
+
+int SPIStream::isRunning()
+{
+    return m_handle >= 0 ? 1 : 0;
+}
+
+
+/** @brief Get the counters for the current or last stream.
+ */
+void SPIStream::getStats(SPI_STREAM_STATS* stats)
+{
+    stats->bytes     = m_bytes;
+    stats->halves    = m_stream.sent;
+    stats->underruns = m_stream.underruns;
+    stats->stalls    = m_stalls;
+}
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
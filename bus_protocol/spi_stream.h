@@ -0,0 +1,86 @@
+#ifndef __SPI_STREAM_H__
+#define __SPI_STREAM_H__
+
+#include "spi.h"
+
+// Counters kept for one stream
+typedef struct SPI_STREAM_STATS
+{
+    uint32_t bytes;                 // Bytes handed to the cog
+    uint32_t halves;                // Halves clocked out
+    uint32_t underruns;             // Times the cog ran dry before the end
+    uint32_t stalls;                // Times the producer waited for a free half
+} SPI_STREAM_STATS;
+
+
+/** @brief Producer side of a streaming SPI transfer, like a DMA channel.
+ *
+ *  For output of any length at full rate, such as SD card multi-block 
+ *  writes or display refreshes.  Once start() posts the stream, the cog 
+ *  holds CS low and clocks each half of a double buffered hub ring as soon
+ *  as it is handed over, while the producer fills the other half.
+ *
+ *  Data goes in with write(), which copies and hands over halves as they 
+ *  fill, or without the copy by filling nextHalf() in place and calling 
+ *  commit().  Both block while the cog still owns both halves; each such 
+ *  wait counts as a stall.  When the cog drains the ring before finish(), 
+ *  SCLK pauses and an underrun is counted, so sizing the halves for the 
+ *  producer's worst gap shows up in the stats.
+ *
+ *  Words are 8 bits and the bytes received replace the sent ones in the 
+ *  ring.  Other commands on the bus wait until finish().
+ */
+class SPIStream
+{
+public:
+    SPIStream(SPI& bus, int half = 512);
+    ~SPIStream();
+    
+    int         start();
+    int         write(const uint8_t* data, int len);
+    uint8_t*    nextHalf();
+    int         commit(int len);
+    int         flush();
+    int         finish();
+    int         isRunning();
+    
+    void        getStats(SPI_STREAM_STATS* stats);
+    
+protected:
+    SPI&        m_bus;
+    SPI_STREAM  m_stream;       // Control block shared with the cog
+    int         m_handle;       // Stream command, -1 while stopped
+    uint8_t*    m_cur;          // Half being filled by write(), 0 for none
+    int         m_fill;         // Bytes in m_cur so far
+    uint32_t    m_bytes;
+    uint32_t    m_stalls;
+    
+private:
+    SPIStream(const SPIStream&);
+    SPIStream& operator=(const SPIStream&);
+};
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
@@ -0,0 +1,134 @@
+/*
+ *   bench_i2c.cpp - Runs the I2CBench matrix against the host simulation.  A register
+ *   file device sits at 0x50 and is switched to each case's register width, so every
+ *   address phase ACKs and lands inside the register file.  Build it like any other
+ *   simulation program (see propeller.h) and run:
+ *
+ *     bench_i2c [-q] [-y] [-w spin|backoff|yield] [-n | -s ticks]
+ *
+ *       -q   quick matrix: 400kHz only, a few sizes, 4 transactions per case
+ *       -y   caller waits with I2C_WAIT_YIELD instead of spinning, same as -w yield
+ *       -w   caller waits with the given strategy (default spin)
+ *       -n   bus runs without clock stretching support, the faster bit loop
+ *       -s   device stretches SCL for [ticks] after every byte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "i2c_bench.h"
+#include "sim_i2c_bus.h"
+
+#define BENCH_SCL   28
+#define BENCH_SDA   29
+#define BENCH_ADR   0x50
+
+static int s_errorCases;
+
+
+static void report(const I2C_BENCH_RESULT* res)
+{
+    I2CBench::print(res);
+    if (res->errors)
+        s_errorCases++;
+}
+
+
+int main(int argc, char* argv[])
+{
+    static const int quickFreqs[] = { 400000 };
+    static const int quickSizes[] = { 0, 1, 16, 255 };
+    
+    I2C_BENCH_CONFIG cfg;
+    I2CBench::defaultConfig(&cfg);
+    
+    SimI2CBus           bus(BENCH_SCL, BENCH_SDA);
+    SimI2CRegisterSlave dev(BENCH_ADR, 256, 0);
+    bus.attach(&dev);
+    
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-q") == 0)
+        {
+            cfg.freqs   = quickFreqs;
+            cfg.nfreqs  = sizeof(quickFreqs) / sizeof(quickFreqs[0]);
+            cfg.sizes   = quickSizes;
+            cfg.nsizes  = sizeof(quickSizes) / sizeof(quickSizes[0]);
+            cfg.reps    = 4;
+        }
+        else if (strcmp(argv[i], "-y") == 0)
+            cfg.wait = I2C_WAIT_YIELD;
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+        {
+            const char* w = argv[++i];
+            if (strcmp(w, "spin") == 0)
+                cfg.wait = I2C_WAIT_SPIN;
+            else if (strcmp(w, "backoff") == 0)
+                cfg.wait = I2C_WAIT_BACKOFF;
+            else if (strcmp(w, "yield") == 0)
+                cfg.wait = I2C_WAIT_YIELD;
+            else
+            {
+                printf("Unknown wait strategy %s, use spin, backoff or yield\n", w);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+            cfg.stretch = 0;
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            dev.stretch = strtoul(argv[++i], 0, 0);
+    }
+    
+    I2CBench bench(BENCH_SCL, BENCH_SDA, BENCH_ADR);
+    I2C_BENCH_CONFIG one = cfg;
+    int cases = 0;
+    
+    I2CBench::printHeader();
+    
+    // One register width at a time, with the device expecting that many bytes
+    for (int rb = cfg.min_reg_bytes; rb <= cfg.max_reg_bytes; rb++)
+    {
+        one.min_reg_bytes = one.max_reg_bytes = rb;
+        dev.regBytes = rb;
+        
+        int n = bench.run(one, report);
+        if (n < 0)
+        {
+            printf("\nNo bus at %d Hz for %d register bytes: no free cog or the "
+                   "driver did not come up\n", bench.getFailedFreq(), rb);
+            return 1;
+        }
+        cases += n;
+    }
+    
+    SIM_I2C_STATS st;
+    bus.getStats(&st);
+    printf("\n%d cases, %d with errors, %u bytes on the wire, %u NACKs, %u late waitcnt\n",
+           cases, s_errorCases, (unsigned)st.bytes, (unsigned)st.nacks, 
+           (unsigned)sim_waitcnt_missed());
+    
+    return s_errorCases ? 1 : 0;
+}
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
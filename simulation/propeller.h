@@ -0,0 +1,164 @@
+/*
+ *   propeller.h - Host stand-in for the propgcc <propeller.h> header.  Lets the bus
+ *   classes and their COGC drivers build and run on Linux so they can be exercised
+ *   and benchmarked without hardware.
+ *
+ *   Cogs are threads started by cognew().  Each thread has its own DIRA/OUTA and
+ *   _COGMEM variables.  From C++ every write to DIRA or OUTA is pushed through the
+ *   pin model (see sim_pins.h) at once, so the virtual devices on the pins see each
+ *   edge in the order the cog makes it.  INA is resolved from every cog's outputs
+ *   plus the device pulls.  Counters in the NCO modes drive PHSx[31] onto their
+ *   pins, with PHSx only changing when the cog writes it (FRQx is not applied), and
+ *   are seen at the next pin write, INA read or waitcnt().  CNT runs at CLKFREQ 
+ *   from the host's monotonic clock, less any stretch of more than half a 
+ *   millisecond in which no thread read it.  Time the host spends running other
+ *   processes is so left out and the drivers' timeouts hold on a loaded machine;
+ *   wait on CNT rather than sleeping a fixed time when checking them.
+ *   Cogs spin like the real thing, so give the host a core per running cog or use
+ *   I2C_WAIT_YIELD on the caller for meaningful timing.  With fewer cores than cogs
+ *   a thread spinning on CNT sleeps briefly every few hundred reads so the others
+ *   still make progress.
+ *
+ *   Put this directory ahead of the propgcc include path and build the COGC image 
+ *   as C++ with its main() renamed to the entry that sim_cog_images.cpp registers
+ *   for it:
+ *
+ *     g++ -x c++ -std=gnu++11 -Isimulation -Ibus_protocol -Dmain=I2CDriver_cog_main \
+ *         -c bus_protocol/i2c_driver.cogc -o i2c_driver_cog.o
+ *     g++ -x c++ -std=gnu++11 -Isimulation -Ibus_protocol -Dmain=I2CMultiDriver_cog_main \
+ *         -c bus_protocol/i2c_multi_driver.cogc -o i2c_multi_driver_cog.o
+ *     g++ -x c++ -std=gnu++11 -Isimulation -Ibus_protocol -Dmain=SPIDriver_cog_main \
+ *         -c bus_protocol/spi_driver.cogc -o spi_driver_cog.o
+ *     g++ -std=gnu++11 -pthread -Isimulation -Ibus_protocol -o app \
+ *         simulation/sim_propeller.cpp simulation/sim_cog_images.cpp \
+ *         simulation/sim_i2c_bus.cpp simulation/sim_spi_bus.cpp simulation/sim_spi.cpp \
+ *         bus_protocol/i2c.cpp bus_protocol/i2c_multi.cpp bus_protocol/i2c_eeprom.cpp \
+ *         bus_protocol/i2c_regcache.cpp bus_protocol/i2c_bench.cpp \
+ *         bus_protocol/spi.cpp bus_protocol/spi_chain.cpp bus_protocol/spi_stream.cpp \
+ *         i2c_driver_cog.o i2c_multi_driver_cog.o spi_driver_cog.o app.cpp
+ *
+ *   where app.cpp is the one file with main(), such as bench_i2c.cpp or the
+ *   regression checks in test_sim.cpp.  Drivers left out of the link just fail
+ *   to start.  simulation/Makefile builds both programs this way, with the cog 
+ *   start timeouts stretched (SIMDEFS), and its check target runs the 
+ *   regression checks.
+ */
+
+#ifndef __SIM_PROPELLER_H__
+#define __SIM_PROPELLER_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Per-cog special registers that have no bus side effects until INA or waitcnt */
+typedef struct SIM_COG_REGS
+{
+    uint32_t dira;
+    uint32_t outa;
+    uint32_t ctra;
+    uint32_t ctrb;
+    uint32_t frqa;
+    uint32_t frqb;
+    uint32_t phsa;
+    uint32_t phsb;
+} SIM_COG_REGS;
+
+uint32_t        sim_cnt(void);
+uint32_t        sim_ina(void);
+uint32_t        sim_clkfreq(void);
+uintptr_t       sim_par(void);
+SIM_COG_REGS*   sim_regs(void);
+void            sim_write_pins(uint32_t dira, uint32_t outa);
+
+uint32_t        waitcnt(uint32_t target);
+void            waitpeq(uint32_t state, uint32_t mask);
+void            waitpne(uint32_t state, uint32_t mask);
+int             cognew(void *code, void *par);
+void            cogstop(int id);
+int             cogid(void);
+int             locknew(void);
+void            lockret(int id);
+int             lockset(int id);
+int             lockclr(int id);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#define CNT         (sim_cnt())
+#define INA         (sim_ina())
+#define PAR         (sim_par())
+#define CLKFREQ     (sim_clkfreq())
+#define _CLKFREQ    (sim_clkfreq())
+#if defined(__cplusplus)
+
+/* Pin register proxy that resolves the pins on every write */
+class SimPinReg
+{
+public:
+    SimPinReg(uint32_t SIM_COG_REGS::*reg) : m_reg(reg) {};
+    operator uint32_t() const                   { return sim_regs()->*m_reg; };
+    uint32_t operator=(uint32_t v) const        { return set(v); };
+    uint32_t operator|=(uint32_t v) const       { return set((sim_regs()->*m_reg) | v); };
+    uint32_t operator&=(uint32_t v) const       { return set((sim_regs()->*m_reg) & v); };
+    uint32_t operator^=(uint32_t v) const       { return set((sim_regs()->*m_reg) ^ v); };
+
+private:
+    uint32_t SIM_COG_REGS::*m_reg;
+
+    uint32_t set(uint32_t v) const
+    {
+        SIM_COG_REGS *r = sim_regs();
+        r->*m_reg = v;
+        sim_write_pins(r->dira, r->outa);
+        return v;
+    };
+};
+
+#define DIRA        (SimPinReg(&SIM_COG_REGS::dira))
+#define OUTA        (SimPinReg(&SIM_COG_REGS::outa))
+
+#else
+
+#define DIRA        (sim_regs()->dira)
+#define OUTA        (sim_regs()->outa)
+
+#endif
+#define CTRA        (sim_regs()->ctra)
+#define CTRB        (sim_regs()->ctrb)
+#define FRQA        (sim_regs()->frqa)
+#define FRQB        (sim_regs()->frqb)
+#define PHSA        (sim_regs()->phsa)
+#define PHSB        (sim_regs()->phsb)
+
+#define _COGMEM     __thread
+#define _NATIVE
+#define _NAKED
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
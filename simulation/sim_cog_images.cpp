@@ -0,0 +1,34 @@
+/*
+ *   sim_cog_images.cpp - Code image symbols for the COGC drivers built for the host.
+ *   Each driver is compiled as C++ with -Dmain=<name>_cog_main (see propeller.h)
+ *   and cognew() runs that entry on its own thread.
+ */
+
+#include "sim_pins.h"
+
+SIM_COG_IMAGE(I2CDriver, I2CDriver_cog_main)
+SIM_COG_IMAGE(I2CMultiDriver, I2CMultiDriver_cog_main)
+SIM_COG_IMAGE(SPIDriver, SPIDriver_cog_main)
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
@@ -0,0 +1,413 @@
+/*
+ *   sim_i2c_bus.cpp - Virtual I2C bus for the host simulation.  Watches the SCL and
+ *   SDA levels the driver cog produces, decodes START/STOP and bits, and plays the
+ *   slave side of the protocol: ACKs, data bits and clock stretching.  Slaves only
+ *   change SDA while SCL is low, like real parts.
+ */
+
+#include <stdlib.h>
+#include "sim_i2c_bus.h"
+
+
+SimI2CSlave::SimI2CSlave(uint8_t adr)
+{
+    m_adr       = adr;
+    m_written   = 0;
+    stretch     = 0;
+    nackAddress = 0;
+    nackAfter   = -1;
+}
+
+
+int SimI2CSlave::start(int read)
+{
+    m_written = 0;
+    return 1;
+}
+
+
+int SimI2CSlave::write(uint8_t byte)
+{
+    if (nackAfter >= 0 && m_written >= nackAfter)
+        return 0;
+
+    m_written++;
+    return 1;
+}
+
+
+uint8_t SimI2CSlave::read()
+{
+    return 0xFF;
+}
+
+
+void SimI2CSlave::stop()
+{
+}
+
+
+
+SimI2CRegisterSlave::SimI2CRegisterSlave(uint8_t adr, int size, int regBytes) : SimI2CSlave(adr)
+{
+    this->size     = size;
+    this->regBytes = regBytes;
+    regs           = (uint8_t *)calloc(size, 1);
+    m_ptr          = 0;
+    m_regSeen      = 0;
+}
+
+
+SimI2CRegisterSlave::~SimI2CRegisterSlave()
+{
+    free(regs);
+}
+
+
+int SimI2CRegisterSlave::start(int read)
+{
+    if (!read)
+        m_regSeen = 0;
+
+    return SimI2CSlave::start(read);
+}
+
+
+int SimI2CRegisterSlave::write(uint8_t byte)
+{
+    if (!SimI2CSlave::write(byte))
+        return 0;
+
+    if (m_regSeen < regBytes)
+    {   // Register address, high byte first.  Reduced on every byte so a 
+        // short address phase still leaves the pointer inside the file.
+        m_ptr = (m_regSeen ? (m_ptr << 8) | byte : byte) % size;
+        m_regSeen++;
+    }
+    else
+    {
+        regs[m_ptr] = byte;
+        m_ptr = (m_ptr + 1) % size;
+    }
+
+    return 1;
+}
+
+
+uint8_t SimI2CRegisterSlave::read()
+{
+    uint8_t byte = regs[m_ptr];
+    m_ptr = (m_ptr + 1) % size;
+    return byte;
+}
+
+
+
+SimI2CEepromSlave::SimI2CEepromSlave(uint8_t adr, int size, int regBytes, int page,
+                                     uint32_t writeTicks) 
+    : SimI2CRegisterSlave(adr, size, regBytes)
+{
+    this->page       = page;
+    this->writeTicks = writeTicks;
+    writeCycles      = 0;
+    busyNacks        = 0;
+    m_dataWritten    = 0;
+    m_busy           = 0;
+    m_busyUntil      = 0;
+}
+
+
+int SimI2CEepromSlave::start(int read)
+{
+    if (m_busy && (int32_t)(CNT - m_busyUntil) < 0)
+    {
+        busyNacks++;
+        return 0;
+    }
+    
+    m_busy        = 0;
+    m_dataWritten = 0;
+    return SimI2CRegisterSlave::start(read);
+}
+
+
+int SimI2CEepromSlave::write(uint8_t byte)
+{
+    if (m_regSeen < regBytes)
+        return SimI2CRegisterSlave::write(byte);
+    
+    if (!SimI2CSlave::write(byte))
+        return 0;
+    
+    // Data wraps around inside the current page
+    regs[m_ptr] = byte;
+    m_ptr = (m_ptr & ~(uint32_t)(page - 1)) | ((m_ptr + 1) & (page - 1));
+    m_dataWritten++;
+    return 1;
+}
+
+
+void SimI2CEepromSlave::stop()
+{
+    if (m_dataWritten > 0)
+    {
+        writeCycles++;
+        m_busy        = 1;
+        m_busyUntil   = CNT + writeTicks;
+        m_dataWritten = 0;
+    }
+}
+
+
+SimI2CBus::SimI2CBus(int scl, int sda)
+{
+    m_scl       = 1 << scl;
+    m_sda       = 1 << sda;
+    m_lines     = m_scl | m_sda;
+    m_nslaves   = 0;
+    m_active    = 0;
+    m_phase     = BUS_IDLE;
+    m_clk       = 0;
+    m_byte      = 0;
+    m_ack       = 0;
+    m_reading   = 0;
+    m_holding   = 0;
+    m_holdUntil = 0;
+    resetStats();
+
+    sim_set_pullup(m_scl | m_sda, 1);
+    sim_attach(this);
+}
+
+
+SimI2CBus::~SimI2CBus()
+{
+    sim_detach(this);
+    sim_set_pullup(m_scl | m_sda, 0);
+}
+
+
+/** @brief Add a slave to the bus.  Attach slaves before starting traffic.
+ */
+void SimI2CBus::attach(SimI2CSlave* slave)
+{
+    if (m_nslaves < (int)(sizeof(m_slaves) / sizeof(m_slaves[0])))
+        m_slaves[m_nslaves++] = slave;
+}
+
+
+/** @brief Let go of SCL after a SIM_STRETCH_FOREVER stretch.
+ */
+void SimI2CBus::releaseScl()
+{
+    m_holding = 0;
+    m_pullLow &= ~m_scl;
+}
+
+
+void SimI2CBus::getStats(SIM_I2C_STATS* stats)
+{
+    *stats = m_stats;
+}
+
+
+void SimI2CBus::resetStats()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+void SimI2CBus::update(uint32_t lines, uint32_t cnt)
+{
+    // Let go of an expired clock stretch, the pins get resolved again after this
+    if (m_holding == 1 && (int32_t)(cnt - m_holdUntil) >= 0)
+    {
+        m_holding = 0;
+        m_pullLow &= ~m_scl;
+    }
+
+    int scl0 = (m_lines & m_scl) != 0;
+    int sda0 = (m_lines & m_sda) != 0;
+    int scl1 = (lines & m_scl) != 0;
+    int sda1 = (lines & m_sda) != 0;
+
+    m_lines = lines;
+
+    if (scl0 && scl1)
+    {   // SDA moving while SCL is high is a START or STOP
+        if (sda0 && !sda1)
+            onStart();
+        else if (!sda0 && sda1)
+            onStop();
+    }
+    else if (scl0 && !scl1)
+        onFall(cnt);
+    else if (!scl0 && scl1)
+        onRise(sda1);
+}
+
+
+void SimI2CBus::onStart()
+{
+    m_stats.starts++;
+
+    if (m_active)
+        m_active->stop();
+
+    m_active = 0;
+    m_phase  = BUS_RX;
+    m_clk    = 0;
+    m_byte   = 0;
+    driveSda(1);
+}
+
+
+void SimI2CBus::onStop()
+{
+    m_stats.stops++;
+
+    if (m_active)
+        m_active->stop();
+
+    m_active = 0;
+    m_phase  = BUS_IDLE;
+    driveSda(1);
+}
+
+
+void SimI2CBus::onRise(int sda)
+{
+    switch (m_phase)
+    {
+        case BUS_RX:
+            if (m_clk < 8)
+                m_byte = (m_byte << 1) | sda;
+            m_clk++;
+            break;
+
+        case BUS_TX:
+            if (m_clk == 8)
+                m_ack = !sda;                   // Master ACK/NACK
+            m_clk++;
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+void SimI2CBus::onFall(uint32_t cnt)
+{
+    if (m_phase == BUS_RX)
+    {
+        if (m_clk == 8)
+        {   // Byte in, answer with an ACK on the ninth clock
+            m_stats.bytes++;
+
+            if (m_active == 0)
+            {
+                m_reading = m_byte & 1;
+                for (int i = 0; i < m_nslaves; i++)
+                    if (m_slaves[i]->address() == (m_byte >> 1))
+                    {
+                        if (!m_slaves[i]->nackAddress && m_slaves[i]->start(m_reading))
+                            m_active = m_slaves[i];
+                        break;
+                    }
+                m_ack = m_active != 0;
+            }
+            else
+                m_ack = m_active->write(m_byte);
+
+            if (!m_ack)
+                m_stats.nacks++;
+            driveSda(!m_ack);
+        }
+        else if (m_clk == 9)
+        {   // ACK clock done
+            driveSda(1);
+            m_clk  = 0;
+            m_byte = 0;
+
+            if (!m_ack)
+                m_phase = BUS_IGNORE;           // Wait for STOP or START
+            else
+            {
+                if (m_reading)
+                {
+                    m_phase = BUS_TX;
+                    m_byte  = m_active->read();
+                    m_stats.bytes++;
+                    driveSda(m_byte & 0x80);
+                }
+                holdScl(m_active->stretch, cnt);
+            }
+        }
+    }
+    else if (m_phase == BUS_TX)
+    {
+        if (m_clk < 8)
+            driveSda((m_byte >> (7 - m_clk)) & 1);
+        else if (m_clk == 8)
+            driveSda(1);                        // Master drives the ACK
+        else
+        {
+            m_clk = 0;
+            if (m_ack)
+            {
+                m_byte = m_active->read();
+                m_stats.bytes++;
+                driveSda(m_byte & 0x80);
+                holdScl(m_active->stretch, cnt);
+            }
+            else
+                m_phase = BUS_IGNORE;
+        }
+    }
+}
+
+
+void SimI2CBus::driveSda(int level)
+{
+    if (level)
+        m_pullLow &= ~m_sda;
+    else
+        m_pullLow |= m_sda;
+}
+
+
+void SimI2CBus::holdScl(uint32_t ticks, uint32_t cnt)
+{
+    if (ticks == 0)
+        return;
+
+    m_stats.stretches++;
+    m_holding   = (ticks == SIM_STRETCH_FOREVER) ? 2 : 1;
+    m_holdUntil = cnt + ticks;
+    m_pullLow  |= m_scl;
+}
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
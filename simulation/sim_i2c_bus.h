@@ -0,0 +1,176 @@
+/*
+ * Bit level virtual I2C bus and scriptable slave devices for the host
+ * simulation.
+ */
+
+#ifndef __SIM_I2C_BUS_H__
+#define __SIM_I2C_BUS_H__
+
+#include "sim_pins.h"
+
+#define SIM_STRETCH_FOREVER     0xFFFFFFFF      // Hold SCL until told otherwise
+
+
+/** @brief A device on the virtual I2C bus.
+ *
+ *  The bus decodes START, STOP, bits and ACKs and talks to the addressed slave
+ *  one byte at a time.  Override the byte level hooks to model a device.  The
+ *  public fields script its misbehavior and can be changed at any time.
+ */
+class SimI2CSlave
+{
+public:
+    SimI2CSlave(uint8_t adr);
+    virtual ~SimI2CSlave() {};
+
+    uint8_t         address() const { return m_adr; };
+
+    virtual int     start(int read);            // Addressed, return 1 to ACK
+    virtual int     write(uint8_t byte);        // Byte from master, return 1 to ACK
+    virtual uint8_t read();                     // Next byte for the master
+    virtual void    stop();                     // STOP or repeated START seen
+
+    uint32_t        stretch;        // Ticks to hold SCL low after each byte (0 for none)
+    int             nackAddress;    // NACK the address byte
+    int             nackAfter;      // NACK data writes after this many bytes (-1 never)
+
+protected:
+    uint8_t         m_adr;          // 7 bit address
+    int             m_written;      // Data bytes written since the address
+};
+
+
+/** @brief Register file device with auto-incrementing register pointer.
+ *
+ *  The first [regBytes] bytes of a write set the register pointer, high byte
+ *  first, and always stay inside the file however many of them arrive.
+ *  Following writes store data, reads return data, and both advance the
+ *  pointer, wrapping at [size].  With [regBytes] at 0 the pointer is only
+ *  moved by the data.
+ */
+class SimI2CRegisterSlave : public SimI2CSlave
+{
+public:
+    SimI2CRegisterSlave(uint8_t adr, int size = 256, int regBytes = 1);
+    ~SimI2CRegisterSlave();
+
+    int             start(int read);
+    int             write(uint8_t byte);
+    uint8_t         read();
+
+    uint8_t*        regs;           // Register contents, [size] bytes
+    int             size;           // Register file size in bytes
+    int             regBytes;       // Register address bytes (0-4)
+
+protected:
+    uint32_t        m_ptr;          // Register pointer
+    int             m_regSeen;      // Register address bytes received so far
+};
+
+
+/** @brief 24xx style serial EEPROM.
+ *
+ *  A register device with a [regBytes] wide memory address whose writes wrap
+ *  inside a [page] byte page, like the real parts.  After a STOP that ends a
+ *  write it ignores its address for [writeTicks] while it "programs", so 
+ *  masters have to ACK poll or wait.
+ */
+class SimI2CEepromSlave : public SimI2CRegisterSlave
+{
+public:
+    SimI2CEepromSlave(uint8_t adr, int size = 32768, int regBytes = 2, int page = 64,
+                      uint32_t writeTicks = 400000);
+
+    int             start(int read);
+    int             write(uint8_t byte);
+    void            stop();
+
+    int             page;           // Page size in bytes (power of 2)
+    uint32_t        writeTicks;     // Write cycle time in ticks (400000 = 5ms)
+    uint32_t        writeCycles;    // Write cycles run
+    uint32_t        busyNacks;      // Addresses ignored during a write cycle
+
+protected:
+    int             m_dataWritten;  // Data bytes written since the address
+    int             m_busy;         // In a write cycle
+    uint32_t        m_busyUntil;    // CNT the write cycle ends
+};
+
+
+// Traffic counters kept by the bus
+typedef struct SIM_I2C_STATS
+{
+    uint32_t starts;                // START and repeated START conditions
+    uint32_t stops;                 // STOP conditions
+    uint32_t bytes;                 // Bytes moved including address bytes
+    uint32_t nacks;                 // Bytes not acknowledged by a slave
+    uint32_t stretches;             // Times a slave held SCL
+} SIM_I2C_STATS;
+
+
+/** @brief Open drain I2C bus on two simulated pins.
+ *
+ *  Attaches itself to the pin model, pulls both pins up and decodes the
+ *  traffic the driver cog produces.  Slaves are added with attach().
+ */
+class SimI2CBus : public SimPinDevice
+{
+public:
+    SimI2CBus(int scl, int sda);
+    ~SimI2CBus();
+
+    void            attach(SimI2CSlave* slave);
+    void            update(uint32_t lines, uint32_t cnt);
+    void            releaseScl();
+    void            getStats(SIM_I2C_STATS* stats);
+    void            resetStats();
+
+protected:
+    enum PHASE { BUS_IDLE, BUS_RX, BUS_TX, BUS_IGNORE };
+
+    uint32_t        m_scl;          // SCL pin mask
+    uint32_t        m_sda;          // SDA pin mask
+    uint32_t        m_lines;        // Levels seen on the last update
+    SimI2CSlave*    m_slaves[16];
+    int             m_nslaves;
+    SimI2CSlave*    m_active;       // Addressed slave, 0 while waiting for an address
+    PHASE           m_phase;
+    int             m_clk;          // Rising SCL edges seen in the current byte
+    uint8_t         m_byte;         // Byte being shifted
+    int             m_ack;          // ACK to send / received for the current byte
+    int             m_reading;      // Addressed for a read
+    int             m_holding;      // Holding SCL for a clock stretch
+    uint32_t        m_holdUntil;    // CNT to release SCL at
+    SIM_I2C_STATS   m_stats;
+
+    void            onStart();
+    void            onStop();
+    void            onRise(int sda);
+    void            onFall(uint32_t cnt);
+    void            driveSda(int level);
+    void            holdScl(uint32_t ticks, uint32_t cnt);
+};
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
@@ -0,0 +1,80 @@
+/* 
+ * Shared pin model for the host simulation.  Virtual devices attach here to 
+ * watch the resolved pin levels and pull pins low like an open drain output.
+ */
+
+#ifndef __SIM_PINS_H__
+#define __SIM_PINS_H__
+
+#include "propeller.h"
+
+/** @brief Base class for anything wired to the simulated pins.
+ *
+ *  update() is called with the resolved pin levels every time a cog writes 
+ *  DIRA or OUTA, reads INA or calls waitcnt().  A device reacts by changing m_pullLow, the mask of pins 
+ *  it is holding low.  Pins are re-resolved and devices updated again until the
+ *  pulls settle, so update() must be safe to call repeatedly with the same 
+ *  levels.
+ */
+class SimPinDevice
+{
+public:
+    SimPinDevice() : m_pullLow(0) {};
+    virtual ~SimPinDevice() {};
+
+    virtual void update(uint32_t lines, uint32_t cnt) = 0;
+    uint32_t     pullLow() const { return m_pullLow; };
+
+protected:
+    uint32_t    m_pullLow;          // Pins this device is holding low
+};
+
+
+void        sim_attach(SimPinDevice* dev);
+void        sim_detach(SimPinDevice* dev);
+void        sim_set_pullup(uint32_t mask, int on);
+uint32_t    sim_waitcnt_missed();
+
+
+/** @brief Registers a host function as the code image of a COGC driver.
+ *
+ *  cognew() looks up the image address it is given and runs the matching 
+ *  entry on a new thread.  Use SIM_COG_IMAGE() to define the _load_start 
+ *  and _load_stop symbols the driver classes expect.  The entry is a weak
+ *  reference, so a driver that was not built in just fails to start.
+ */
+class SimCogImage
+{
+public:
+    SimCogImage(void* image, int (*entry)(void));
+};
+
+#define SIM_COG_IMAGE(name, entry)                                  \
+    int entry(void) __attribute__((weak));                          \
+    uint32_t _load_start_##name##_cog[1];                           \
+    uint32_t _load_stop_##name##_cog[1];                            \
+    static SimCogImage sim_image_##name(_load_start_##name##_cog, entry);
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
@@ -0,0 +1,467 @@
+/*
+ *   sim_propeller.cpp - Host implementation of the propeller.h stand-in.  Cogs run
+ *   as POSIX threads with asynchronous cancellation so cogstop() can halt a cog
+ *   that is spinning on hub memory, and the pin model is resolved under a single
+ *   mutex whenever a cog looks at INA or waits on CNT.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include "sim_pins.h"
+
+#define SIM_COGS        8
+#define SIM_LOCKS       8
+#define SIM_CLKFREQ     80000000
+#define SIM_YIELD_READS 256         // CNT reads between naps on a crowded host
+#define SIM_CNT_MAX_GAP 500000      // Longest host gap in ns CNT may jump by
+
+typedef struct SIM_COG
+{
+    SIM_COG_REGS    regs;
+    pthread_t       thread;
+    int             (*entry)(void);
+    uintptr_t       par;
+    volatile int    running;
+    volatile int    started;
+    int             joinable;
+} SIM_COG;
+
+typedef struct SIM_IMAGE
+{
+    void*           image;
+    int             (*entry)(void);
+} SIM_IMAGE;
+
+
+static SIM_COG                      s_cog[SIM_COGS] = { { {0}, 0, 0, 0, 1, 1, 0 } };  // Cog 0 is the host main thread
+static __thread int                 t_cog = 0;
+static __thread int                 t_guards = 0;       // Pin lock held by this thread
+static __thread uint32_t            t_reads = 0;        // CNT reads by this thread
+static pthread_mutex_t              s_pinLock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<SimPinDevice*>   s_devices;
+static uint32_t                     s_pullup;
+static uint32_t                     s_lines;
+static volatile uint32_t            s_missed;
+static pthread_mutex_t              s_cntLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t                     s_cntLast;          // Host ns at the last CNT read
+static uint64_t                     s_cntLost;          // Host ns CNT has left out
+static volatile int                 s_lockUsed[SIM_LOCKS];
+static volatile int                 s_lockState[SIM_LOCKS];
+
+static std::vector<SIM_IMAGE>& images()
+{   // Built on first use, images register from static constructors
+    static std::vector<SIM_IMAGE> list;
+    return list;
+}
+
+
+/** @brief Holds off cancellation of the calling cog thread.
+ *
+ *  Cog threads are cancelled asynchronously, which is only safe in code with
+ *  complete unwind information and no locks held.  Library calls such as 
+ *  clock_gettime() and anything that takes the pin lock run under one of these.
+ *  A cancel that arrived in the meantime is acted on as the destructor turns 
+ *  cancellation back on, so the destructor has to let the unwind through.
+ */
+class SimNoCancel
+{
+public:
+    SimNoCancel()  { pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &m_old); };
+    ~SimNoCancel() noexcept(false) { pthread_setcancelstate(m_old, &m_old); };
+private:
+    int m_old;
+};
+
+
+/** @brief Holds the pin model lock with cancellation held off.
+ */
+class SimGuard : public SimNoCancel
+{
+public:
+    SimGuard()  { pthread_mutex_lock(&s_pinLock); t_guards++; };
+    ~SimGuard() noexcept(false) { t_guards--; pthread_mutex_unlock(&s_pinLock); };
+};
+
+
+static uint32_t counterPins(uint32_t ctr, uint32_t phs)
+{/* Pins a counter drives in the NCO modes, PHS[31] on APIN and its inverse 
+    on BPIN for the differential mode.  PHS only moves when the cog writes it,
+    which is exact for FRQ = 0, the way drivers use NCO to shift data out. */
+
+    uint32_t mode = (ctr >> 26) & 0x1F;
+    uint32_t apin = ctr & 0x3F;
+    uint32_t bpin = (ctr >> 9) & 0x3F;
+    uint32_t bit  = phs >> 31;
+    uint32_t pins = 0;
+
+    if (mode != 4 && mode != 5)
+        return 0;
+
+    if (apin < 32)
+        pins |= bit << apin;
+    if (mode == 5 && bpin < 32)
+        pins |= (bit ^ 1) << bpin;
+    return pins;
+}
+
+
+static uint32_t resolve(uint32_t cnt)
+{/* Combine every cog's outputs with the device pulls and let the devices react
+    until the pulls settle.  Caller holds the pin lock. */
+
+    uint32_t dir = 0;
+    uint32_t out = 0;
+
+    for (int i = 0; i < SIM_COGS; i++)
+    {
+        SIM_COG_REGS *r = &s_cog[i].regs;
+
+        if (!s_cog[i].running)
+            continue;
+        dir |= r->dira;
+        out |= r->dira & (r->outa | counterPins(r->ctra, r->phsa) | counterPins(r->ctrb, r->phsb));
+    }
+
+    for (int pass = 0; pass < 4; pass++)
+    {
+        uint32_t pull = 0;
+        for (size_t d = 0; d < s_devices.size(); d++)
+            pull |= s_devices[d]->pullLow();
+
+        s_lines = out | (~dir & s_pullup & ~pull);
+
+        for (size_t d = 0; d < s_devices.size(); d++)
+            s_devices[d]->update(s_lines, cnt);
+
+        uint32_t settled = 0;
+        for (size_t d = 0; d < s_devices.size(); d++)
+            settled |= s_devices[d]->pullLow();
+        if (settled == pull)
+            break;
+    }
+
+    return s_lines;
+}
+
+
+static int crowded()
+{/* More cogs running than the host has cores, so a cog spinning on CNT keeps
+    the others off their core for a whole scheduler slice */
+
+    static long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int running = 0;
+
+    for (int i = 0; i < SIM_COGS; i++)
+        running += s_cog[i].running;
+    return running > cores;
+}
+
+
+static void* cogThread(void* arg)
+{
+    SIM_COG *cog = (SIM_COG *)arg;
+
+    t_cog = cog - s_cog;
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, 0);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, 0);
+    cog->started = 1;
+
+    cog->entry();
+
+    {
+        SimGuard guard;
+        cog->running = 0;
+        resolve(sim_cnt());
+    }
+    return 0;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// propeller.h stand-ins
+//
+
+uint32_t sim_cnt(void)
+{
+    SimNoCancel hold;
+    struct timespec ts;
+
+    // Every wait loop reads CNT, so this is where a spinning cog hands its
+    // core over, never while it holds the pin lock.  sched_yield() does not
+    // reliably run the other threads on a single core, a short sleep does.
+    if ((++t_reads & (SIM_YIELD_READS - 1)) == 0 && t_guards == 0 && crowded())
+    {
+        struct timespec nap = { 0, 1000 };
+        nanosleep(&nap, 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    // Running cogs read CNT every few microseconds, so a longer gap means
+    // the host had the whole simulation off the CPU.  Leave that time out,
+    // otherwise every timeout in the drivers runs short on a busy machine.
+    uint64_t ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    pthread_mutex_lock(&s_cntLock);
+    if (ns > s_cntLast)
+    {   // Another thread may have read a later time after we read ours
+        if (s_cntLast != 0 && ns - s_cntLast > SIM_CNT_MAX_GAP)
+            s_cntLost += ns - s_cntLast - SIM_CNT_MAX_GAP;
+        s_cntLast = ns;
+    }
+    ns = s_cntLast - s_cntLost;
+    pthread_mutex_unlock(&s_cntLock);
+
+    return (uint32_t)(ns * (SIM_CLKFREQ / 1000000) / 1000);
+}
+
+
+uint32_t sim_ina(void)
+{
+    SimGuard guard;
+    return resolve(sim_cnt());
+}
+
+
+uint32_t sim_clkfreq(void)
+{
+    return SIM_CLKFREQ;
+}
+
+
+uintptr_t sim_par(void)
+{
+    return s_cog[t_cog].par;
+}
+
+
+SIM_COG_REGS* sim_regs(void)
+{
+    return &s_cog[t_cog].regs;
+}
+
+
+void sim_write_pins(uint32_t dira, uint32_t outa)
+{   // Registers are already stored, just let the devices see the change
+    SimGuard guard;
+    resolve(sim_cnt());
+}
+
+
+uint32_t waitcnt(uint32_t target)
+{
+    {   // Let the devices see whatever the cog changed before waiting
+        SimGuard guard;
+        resolve(sim_cnt());
+    }
+
+    // Real hardware would wait a full CNT wrap (~53s @ 80MHz) for a target
+    // that has already passed.  Count it so drivers can be checked for it.
+    if ((int32_t)(sim_cnt() - target) > 0)
+        s_missed++;
+
+    while ((int32_t)(sim_cnt() - target) < 0)
+        ;
+
+    return target;
+}
+
+
+void waitpeq(uint32_t state, uint32_t mask)
+{
+    while ((sim_ina() & mask) != state)
+    {
+        SimNoCancel hold;
+        sched_yield();
+    }
+}
+
+
+void waitpne(uint32_t state, uint32_t mask)
+{
+    while ((sim_ina() & mask) == state)
+    {
+        SimNoCancel hold;
+        sched_yield();
+    }
+}
+
+
+int cognew(void *code, void *par)
+{
+    int (*entry)(void) = 0;
+
+    for (size_t i = 0; i < images().size(); i++)
+        if (images()[i].image == code)
+            entry = images()[i].entry;
+
+    if (entry == 0)
+        return -1;
+
+    SIM_COG *cog = 0;
+
+    {
+        SimGuard guard;
+
+        for (int id = 1; id < SIM_COGS && cog == 0; id++)
+            if (!s_cog[id].running && !s_cog[id].joinable)
+                cog = &s_cog[id];
+
+        if (cog == 0)
+            return -1;
+
+        memset(&cog->regs, 0, sizeof(cog->regs));
+        cog->entry   = entry;
+        cog->par     = (uintptr_t)par;
+        cog->started = 0;
+        cog->running = 1;
+
+        if (pthread_create(&cog->thread, 0, cogThread, cog) != 0)
+        {
+            cog->running = 0;
+            return -1;
+        }
+        cog->joinable = 1;
+    }
+
+    // A real cog loads in ~100us; make sure the thread is actually up so a
+    // host with few cores doesn't leave it waiting behind a spinning caller.
+    while (!cog->started)
+        sched_yield();
+
+    return cog - s_cog;
+}
+
+
+void cogstop(int id)
+{
+    if (id <= 0 || id >= SIM_COGS || id == t_cog)
+        return;
+
+    SIM_COG *cog = &s_cog[id];
+
+    if (!cog->joinable)
+        return;
+
+    if (cog->running)
+        pthread_cancel(cog->thread);
+    pthread_join(cog->thread, 0);
+    cog->joinable = 0;
+
+    SimGuard guard;
+    cog->running = 0;
+    memset(&cog->regs, 0, sizeof(cog->regs));
+    resolve(sim_cnt());
+}
+
+
+int cogid(void)
+{
+    return t_cog;
+}
+
+
+int locknew(void)
+{
+    for (int i = 0; i < SIM_LOCKS; i++)
+        if (!__sync_lock_test_and_set(&s_lockUsed[i], 1))
+        {
+            s_lockState[i] = 0;
+            return i;
+        }
+
+    return -1;
+}
+
+
+void lockret(int id)
+{
+    if (id >= 0 && id < SIM_LOCKS)
+        __sync_lock_release(&s_lockUsed[id]);
+}
+
+
+int lockset(int id)
+{
+    return __sync_lock_test_and_set(&s_lockState[id], 1);
+}
+
+
+int lockclr(int id)
+{
+    return __sync_fetch_and_and(&s_lockState[id], 0);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Pin model
+//
+
+void sim_attach(SimPinDevice* dev)
+{
+    SimGuard guard;
+    s_devices.push_back(dev);
+    resolve(sim_cnt());
+}
+
+
+void sim_detach(SimPinDevice* dev)
+{
+    SimGuard guard;
+    s_devices.erase(std::remove(s_devices.begin(), s_devices.end(), dev), s_devices.end());
+    resolve(sim_cnt());
+}
+
+
+void sim_set_pullup(uint32_t mask, int on)
+{
+    SimGuard guard;
+    if (on)
+        s_pullup |= mask;
+    else
+        s_pullup &= ~mask;
+    resolve(sim_cnt());
+}
+
+
+uint32_t sim_waitcnt_missed()
+{
+    return s_missed;
+}
+
+
+SimCogImage::SimCogImage(void* image, int (*entry)(void))
+{
+    SIM_IMAGE img = { image, entry };
+    images().push_back(img);
+}
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
@@ -0,0 +1,236 @@
+/*
+ *   sim_spi.cpp - Byte level ISPI for the host.  Hands each frame straight to a
+ *   slave model in the same order the pin level bus does: select, then a read()
+ *   before each write(), then deselect.  Bus time is charged from the clock rate
+ *   rather than measured, so the figures do not depend on the host.
+ */
+
+#include <string.h>
+#include "sim_spi.h"
+
+
+/** @brief Put a slave model behind an ISPI.
+ *
+ *  @param SimSPISlave* slave: Device model, must outlive this object
+ *  @param int slaveMode: SPI mode the device expects
+ *  @param int speed: SCLK frequency in Hz
+ *  @param int mode: SPI mode the master starts in
+ */
+SimSPI::SimSPI(SimSPISlave* slave, int slaveMode, int speed, int mode)
+{
+    m_slave     = slave;
+    m_slaveMode = slaveMode & 3;
+    m_open      = 0;
+    m_realTime  = 0;
+    m_spiBPW    = 8;
+    m_spiMode   = mode & 3;
+    m_speed     = speed > 0 ? speed : 1000000;
+    resetStats();
+}
+
+
+int SimSPI::openBus()
+{
+    m_open = 1;
+    return 0;
+}
+
+
+int SimSPI::closeBus()
+{
+    m_open = 0;
+    return 0;
+}
+
+
+int SimSPI::isReady()
+{
+    return (m_open && m_slave) ? 1 : 0;
+}
+
+
+/** @brief Set the word width, whole bytes only.
+ *
+ *  @param int val: Bits per word (8|16|24|32)
+ *  @return int: 0 on success, -1 if not supported
+ */
+int SimSPI::setBPW(int val)
+{
+    if (val < 8 || val > 32 || (val & 7))
+        return -1;
+    
+    m_spiBPW = val;
+    return 0;
+}
+
+
+int SimSPI::setSpeed(int val)
+{
+    if (val <= 0)
+        return -1;
+    
+    m_speed = val;
+    return 0;
+}
+
+
+int SimSPI::setMode(int val)
+{
+    if (val < 0 || val > 3)
+        return -1;
+    
+    m_spiMode = val;
+    return 0;
+}
+
+
+int SimSPI::rwData(uint8_t *data, uint8_t len)
+{
+    uint32_t start = CNT;
+    
+    if (!isReady() || len % (m_spiBPW >> 3))
+        return -1;
+    
+    frame(data, len);
+    charge(start, 1, len);
+    return 0;
+}
+
+
+uint8_t SimSPI::rwByte(uint8_t bt)
+{
+    uint32_t start = CNT;
+    
+    if (!isReady())
+        return 0xFF;
+    
+    frame(&bt, 1);
+    charge(start, 1, 1);
+    return bt;
+}
+
+
+uint16_t SimSPI::rwWord(uint16_t wd)
+{
+    uint32_t start = CNT;
+    uint8_t  bytes[2];
+    
+    if (!isReady())
+        return 0xFFFF;
+    
+    bytes[0] = wd >> 8;
+    bytes[1] = wd;
+    frame(bytes, 2);
+    charge(start, 1, 2);
+    return (bytes[0] << 8) | bytes[1];
+}
+
+
+/** @brief Back to back CS frames in one call, as SPI::rwFrames().
+ *
+ *  @param uint8_t* data: Bytes to send, overwritten with the bytes received
+ *  @param int len: Length of [data] in bytes
+ *  @param int frame: Bytes per CS frame, a whole number of words
+ *  @return int: 0 on success, -1 on error
+ */
+int SimSPI::rwFrames(uint8_t *data, int len, int frame)
+{
+    uint32_t start = CNT;
+    
+    if (!isReady() || frame < 1 || len % frame || frame % (m_spiBPW >> 3))
+        return -1;
+    
+    for (int i = 0; i < len; i += frame)
+        this->frame(data + i, frame);
+    charge(start, len / frame, len);
+    return 0;
+}
+
+
+/** @brief Make each call take its simulated bus time on CNT.
+ *
+ *  @param int on: 1 to pace calls, 0 to return at once
+ */
+void SimSPI::setRealTime(int on)
+{
+    m_realTime = on;
+}
+
+
+void SimSPI::getStats(SIM_ISPI_STATS* stats)
+{
+    *stats = m_stats;
+}
+
+
+void SimSPI::resetStats()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Private Members
+//
+
+void SimSPI::frame(uint8_t *data, int len)
+{/* One CS frame, bytes replaced in place by what the slave sends back */
+    
+    if (m_spiMode != m_slaveMode)
+    {
+        m_stats.mismatches++;
+        memset(data, 0xFF, len);
+        return;
+    }
+    
+    m_slave->select();
+    for (int i = 0; i < len; i++)
+    {
+        uint8_t in = m_slave->read();
+        m_slave->write(data[i]);
+        data[i] = in;
+    }
+    m_slave->deselect();
+}
+
+
+void SimSPI::charge(uint32_t start, int frames, int bytes)
+{/* Count a call and the time it takes on the wire */
+    
+    uint32_t ticks = (uint32_t)((uint64_t)bytes * 8 * CLKFREQ / m_speed) + 
+                     frames * SIM_SPI_CS_TICKS;
+    
+    m_stats.transfers++;
+    m_stats.frames += frames;
+    m_stats.bytes  += bytes;
+    m_stats.ticks  += ticks;
+    
+    if (m_realTime)
+        while ((int32_t)(CNT - (start + ticks)) < 0)
+            ;
+}
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
@@ -0,0 +1,93 @@
+/*
+ * Byte level ISPI on the host, for testing SPI device drivers without a cog.
+ */
+
+#ifndef __SIM_SPI_H__
+#define __SIM_SPI_H__
+
+#include "ispi.h"
+#include "sim_spi_bus.h"
+
+#define SIM_SPI_CS_TICKS    80      // CS high time charged per frame, as SPI_CS_GAP
+
+// Traffic counters kept by SimSPI
+typedef struct SIM_ISPI_STATS
+{
+    uint32_t transfers;             // rwData/rwByte/rwWord/rwFrames calls
+    uint32_t frames;                // CS frames
+    uint32_t bytes;                 // Bytes exchanged
+    uint32_t ticks;                 // Simulated bus time in clock ticks
+    uint32_t mismatches;            // Frames lost to a wrong SPI mode
+} SIM_ISPI_STATS;
+
+
+/** @brief ISPI implementation that talks straight to a slave model.
+ *
+ *  Drivers written against ISPI, such as a stepper or ADC driver, can be
+ *  unit tested on a build machine with one of the SimSPISlave models in 
+ *  place of the chip: SimSPIShiftSlave, SimSPIL6470Slave, SimSPIFlashSlave,
+ *  or a SimSPIChainSlave of them.  Every call is one CS frame exchanged a 
+ *  byte at a time, with no cog, pins or threads involved.
+ *
+ *  Bus time is worked out from the clock rate and frame count and added to
+ *  the stats, so throughput can be estimated for any speed.  With 
+ *  setRealTime() each call also takes that long on CNT.  A call made in a
+ *  mode other than the slave's reaches nothing and reads 0xFF, as a wrong
+ *  mode would garble it on hardware.  Words are whole bytes: 8, 16, 24 or
+ *  32 bits.
+ */
+class SimSPI : public ISPI
+{
+public:
+    SimSPI(SimSPISlave* slave, int slaveMode = 0, int speed = 1000000, int mode = 0);
+    
+    int             openBus();
+    int             closeBus();
+    int             isReady();
+    int             setBPW(int val);
+    int             setSpeed(int val);
+    int             setMode(int val);
+    
+    int             rwData(uint8_t *data, uint8_t len);
+    uint8_t         rwByte(uint8_t bt);
+    uint16_t        rwWord(uint16_t wd);
+    int             rwFrames(uint8_t *data, int len, int frame);
+    
+    void            setRealTime(int on);
+    void            getStats(SIM_ISPI_STATS* stats);
+    void            resetStats();
+    
+protected:
+    SimSPISlave*    m_slave;
+    int             m_slaveMode;    // Mode the slave listens in
+    int             m_open;
+    int             m_realTime;     // Pace calls on CNT
+    SIM_ISPI_STATS  m_stats;
+    
+    void            frame(uint8_t *data, int len);
+    void            charge(uint32_t start, int frames, int bytes);
+};
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
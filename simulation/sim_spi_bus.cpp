@@ -0,0 +1,536 @@
+/*
+ *   sim_spi_bus.cpp - Virtual SPI bus for the host simulation.  Watches SCLK, MOSI
+ *   and the CS pins the driver cog produces and plays the slave side: bits in on
+ *   the sampling edge, bits out on the other, in each slave's own SPI mode.  Also
+ *   the slave models: a daisy chain, an L6470 stepper driver and a NOR flash.
+ */
+
+#include <stdlib.h>
+#include "sim_spi_bus.h"
+
+
+SimSPIBus::SimSPIBus(int sck, int mosi, int miso)
+{
+    m_sck    = 1 << sck;
+    m_mosi   = 1 << mosi;
+    m_miso   = 1 << miso;
+    m_lines  = 0;
+    m_nslots = 0;
+    resetStats();
+    
+    sim_set_pullup(m_miso, 1);
+    sim_attach(this);
+}
+
+
+SimSPIBus::~SimSPIBus()
+{
+    sim_detach(this);
+    sim_set_pullup(m_miso, 0);
+    for (int i = 0; i < m_nslots; i++)
+        sim_set_pullup(m_slots[i].cs, 0);
+}
+
+
+/** @brief Add a slave on its own CS pin.  Attach slaves before starting traffic.
+ */
+void SimSPIBus::attach(SimSPISlave* slave, int cs, int mode)
+{
+    if (m_nslots >= (int)(sizeof(m_slots) / sizeof(m_slots[0])))
+        return;
+    
+    SLOT& s = m_slots[m_nslots++];
+    memset(&s, 0, sizeof(s));
+    s.slave = slave;
+    s.cs    = 1 << cs;
+    s.mode  = mode & 3;
+    sim_set_pullup(s.cs, 1);
+}
+
+
+void SimSPIBus::getStats(SIM_SPI_STATS* stats)
+{
+    *stats = m_stats;
+}
+
+
+void SimSPIBus::resetStats()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+void SimSPIBus::update(uint32_t lines, uint32_t cnt)
+{
+    int edge = ((lines ^ m_lines) & m_sck) != 0;
+    int sck  = (lines & m_sck) != 0;
+    int mosi = (lines & m_mosi) != 0;
+    
+    m_lines = lines;
+    
+    for (int i = 0; i < m_nslots; i++)
+    {
+        SLOT& s = m_slots[i];
+        int active = !(lines & s.cs);
+        
+        if (active && !s.selected)
+        {
+            m_stats.selects++;
+            s.selected = 1;
+            s.bits     = 0;
+            s.in       = 0;
+            s.mark     = cnt;
+            s.slave->select();
+            s.out      = s.slave->read();
+            if (!(s.mode & 1))
+                shiftOut(s);                    // CPHA 0, first bit out before any edge
+            continue;
+        }
+        
+        if (!active && s.selected)
+        {   // A counter driven SCLK edge shows up with the CS write after it
+            if (edge)
+                clock(s, sck, mosi, cnt);
+            s.selected = 0;
+            s.low      = 0;
+            s.slave->deselect();
+            continue;
+        }
+        
+        if (s.selected && edge)
+            clock(s, sck, mosi, cnt);
+    }
+    
+    m_pullLow = 0;
+    for (int i = 0; i < m_nslots; i++)
+        if (m_slots[i].low)
+            m_pullLow |= m_miso;
+}
+
+
+void SimSPIBus::clock(SLOT& s, int sck, int mosi, uint32_t cnt)
+{
+    m_stats.edges++;
+    m_stats.ticks += cnt - s.mark;
+    s.mark = cnt;
+    
+    int leading = sck != ((s.mode >> 1) & 1);
+    
+    if (leading == !(s.mode & 1))
+    {   // Sampling edge
+        s.in = (s.in << 1) | mosi;
+        if (++s.bits == 8)
+        {
+            m_stats.bytes++;
+            s.slave->write(s.in);
+            s.bits = 0;
+            s.in   = 0;
+            s.out  = s.slave->read();
+        }
+    }
+    else
+        shiftOut(s);
+}
+
+
+void SimSPIBus::shiftOut(SLOT& s)
+{
+    s.low   = !(s.out & 0x80);
+    s.out <<= 1;
+}
+
+
+
+void SimSPIChainSlave::add(SimSPISlave* dev)
+{
+    if (m_n < (int)(sizeof(m_devs) / sizeof(m_devs[0])))
+        m_devs[m_n++] = dev;
+}
+
+
+void SimSPIChainSlave::select()
+{
+    for (int d = 0; d < m_n; d++)
+    {
+        m_devs[d]->select();
+        m_stage[d] = m_devs[d]->read();
+    }
+}
+
+
+uint8_t SimSPIChainSlave::read()
+{
+    return m_n ? m_stage[m_n - 1] : 0xFF;
+}
+
+
+void SimSPIChainSlave::write(uint8_t byte)
+{
+    for (int d = m_n - 1; d > 0; d--)
+        m_stage[d] = m_stage[d - 1];
+    if (m_n)
+        m_stage[0] = byte;
+}
+
+
+void SimSPIChainSlave::deselect()
+{
+    for (int d = 0; d < m_n; d++)
+    {
+        m_devs[d]->write(m_stage[d]);
+        m_devs[d]->deselect();
+    }
+}
+
+
+
+// Width in bits and reset value of each L6470 register, 0 width for none
+static const struct { uint8_t bits; uint16_t reset; } s_l6470Regs[SIM_L6470_REGS] =
+{
+    {  0, 0 },
+    { 22, 0 },      { 9, 0 },       { 22, 0 },      { 20, 0 },          // ABS_POS EL_POS MARK SPEED
+    { 12, 0x08A },  { 12, 0x08A },  { 10, 0x041 },  { 13, 0 },          // ACC DEC MAX_SPEED MIN_SPEED
+    {  8, 0x29 },   { 8, 0x29 },    { 8, 0x29 },    { 8, 0x29 },        // KVAL_HOLD RUN ACC DEC
+    { 14, 0x0408 }, { 8, 0x19 },    { 8, 0x29 },    { 8, 0x29 },        // INT_SPEED ST_SLP FN_SLP_ACC DEC
+    {  4, 0 },      { 5, 0 },       { 4, 0x8 },     { 7, 0x40 },        // K_THERM ADC_OUT OCD_TH STALL_TH
+    { 10, 0x027 },  { 8, 0x7 },     { 8, 0xFF },    { 16, 0x2E88 },     // FS_SPD STEP_MODE ALARM_EN CONFIG
+    { 16, 0x7E03 }                                                      // STATUS
+};
+
+#define L6470_BYTES(reg)    ((s_l6470Regs[reg].bits + 7) >> 3)
+#define L6470_MASK(reg)     ((1UL << s_l6470Regs[reg].bits) - 1)
+
+
+void SimSPIL6470Slave::reset()
+{
+    for (int r = 0; r < SIM_L6470_REGS; r++)
+        regs[r] = s_l6470Regs[r].reset;
+    
+    commands = 0;
+    m_cmd    = 0;
+    m_args   = 0;
+    m_value  = 0;
+    m_outLen = 0;
+}
+
+
+uint8_t SimSPIL6470Slave::read()
+{
+    return m_outLen ? m_out[0] : 0x00;
+}
+
+
+void SimSPIL6470Slave::write(uint8_t byte)
+{
+    if (m_outLen)
+    {   // One response byte went out with this one
+        m_out[0] = m_out[1];
+        m_out[1] = m_out[2];
+        m_outLen--;
+    }
+    
+    if (m_args)
+    {
+        m_value = (m_value << 8) | byte;
+        if (--m_args == 0)
+            execute();
+        return;
+    }
+    
+    m_cmd   = byte;
+    m_value = 0;
+    
+    if ((byte & 0xE0) == 0x00 && byte != 0x00 && byte < SIM_L6470_REGS)
+        m_args = L6470_BYTES(byte);                         // SetParam
+    else if ((byte & 0xFE) == 0x50 || (byte & 0xFE) == 0x40 || byte == 0x60 ||
+             (byte & 0xFE) == 0x68 || (byte & 0xF6) == 0x82)
+        m_args = 3;                                         // Run Move GoTo GoTo_DIR GoUntil
+    
+    if (m_args == 0)
+        execute();
+}
+
+
+void SimSPIL6470Slave::execute()
+{/* Run the command in m_cmd with its argument in m_value */
+    
+    uint32_t& status = regs[SIM_L6470_STATUS];
+    uint32_t& pos    = regs[SIM_L6470_ABS_POS];
+    uint8_t   cmd    = m_cmd;
+    uint8_t   reg    = cmd & 0x1F;
+    
+    commands++;
+    
+    if (cmd == 0x00)
+        return;                                             // NOP
+    
+    if ((cmd & 0xE0) == 0x00)
+    {   // SetParam, the read only and missing registers refuse it
+        if (reg >= SIM_L6470_REGS || reg == SIM_L6470_SPEED || reg == SIM_L6470_ADC_OUT || reg == SIM_L6470_STATUS)
+            status |= SIM_L6470_WRONG_CMD;
+        else
+            regs[reg] = m_value & L6470_MASK(reg);
+        return;
+    }
+    
+    if ((cmd & 0xE0) == 0x20)
+    {   // GetParam
+        if (reg > 0 && reg < SIM_L6470_REGS)
+            respond(regs[reg], L6470_BYTES(reg));
+        else
+            status |= SIM_L6470_WRONG_CMD;
+        return;
+    }
+    
+    switch (cmd & 0xFE)
+    {
+        case 0x50:                                          // Run
+            motion(cmd);
+            regs[SIM_L6470_SPEED] = m_value & L6470_MASK(SIM_L6470_SPEED);
+            status |= SIM_L6470_MOT_STATUS;
+            break;
+            
+        case 0x58:                                          // StepClock
+            motion(cmd);
+            break;
+            
+        case 0x40:                                          // Move
+            motion(cmd);
+            m_value &= L6470_MASK(SIM_L6470_ABS_POS);
+            pos = ((cmd & 1) ? pos + m_value : pos - m_value) & L6470_MASK(SIM_L6470_ABS_POS);
+            break;
+            
+        case 0x60:                                          // GoTo
+        case 0x68:                                          // GoTo_DIR
+            motion(cmd);
+            pos = m_value & L6470_MASK(SIM_L6470_ABS_POS);
+            break;
+            
+        case 0x82: case 0x8A:                               // GoUntil
+        case 0x92: case 0x9A:                               // ReleaseSW
+            motion(cmd);
+            if (cmd & 0x08)
+                regs[SIM_L6470_MARK] = pos;
+            else
+                pos = 0;
+            break;
+            
+        case 0x70:                                          // GoHome
+            motion(cmd);
+            pos = 0;
+            break;
+            
+        case 0x78:                                          // GoMark
+            motion(cmd);
+            pos = regs[SIM_L6470_MARK];
+            break;
+            
+        case 0xD8:                                          // ResetPos
+            pos = 0;
+            break;
+            
+        case 0xC0:                                          // ResetDevice
+            reset();
+            break;
+            
+        case 0xA0:                                          // SoftHiZ
+        case 0xA8:                                          // HardHiZ
+            status |= SIM_L6470_HIZ;
+            // fall through
+        case 0xB0:                                          // SoftStop
+        case 0xB8:                                          // HardStop
+            regs[SIM_L6470_SPEED] = 0;
+            status &= ~SIM_L6470_MOT_STATUS;
+            break;
+            
+        case 0xD0:                                          // GetStatus
+            respond(status, 2);
+            status &= ~(SIM_L6470_NOTPERF_CMD | SIM_L6470_WRONG_CMD);
+            break;
+            
+        default:
+            status |= SIM_L6470_WRONG_CMD;
+            break;
+    }
+}
+
+
+void SimSPIL6470Slave::motion(uint8_t cmd)
+{/* Bridges leave high impedance, and commands with a direction bit set DIR.
+    GoTo, GoHome and GoMark take the shortest path, the model keeps DIR. */
+    
+    uint32_t& status = regs[SIM_L6470_STATUS];
+    
+    status &= ~SIM_L6470_HIZ;
+    if (cmd != 0x60 && cmd != 0x70 && cmd != 0x78)
+        status = (status & ~SIM_L6470_DIR) | ((cmd & 1) ? SIM_L6470_DIR : 0);
+}
+
+
+void SimSPIL6470Slave::respond(uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        m_out[i] = value >> ((bytes - 1 - i) * 8);
+    m_outLen = bytes;
+}
+
+
+
+SimSPIFlashSlave::SimSPIFlashSlave(uint32_t size, uint32_t jedec, uint32_t programTicks,
+                                   uint32_t eraseTicks)
+{
+    this->size         = size;
+    this->jedec        = jedec;
+    this->programTicks = programTicks;
+    this->eraseTicks   = eraseTicks;
+    mem                = (uint8_t *)malloc(size);
+    memset(mem, 0xFF, size);
+    programs           = 0;
+    erases             = 0;
+    busyIgnored        = 0;
+    m_cmd              = 0;
+    m_pos              = 0;
+    m_addr             = 0;
+    m_wel              = 0;
+    m_pending          = 0;
+    m_busyUntil        = 0;
+}
+
+
+SimSPIFlashSlave::~SimSPIFlashSlave()
+{
+    free(mem);
+}
+
+
+int SimSPIFlashSlave::busy()
+{
+    if (m_busyUntil && (int32_t)(CNT - m_busyUntil) < 0)
+        return 1;
+    
+    m_busyUntil = 0;
+    return 0;
+}
+
+
+void SimSPIFlashSlave::select()
+{
+    m_cmd     = 0;
+    m_pos     = 0;
+    m_addr    = 0;
+    m_pending = 0;
+}
+
+
+uint8_t SimSPIFlashSlave::read()
+{
+    switch (m_cmd)
+    {
+        case 0x05:                                          // RDSR
+            return m_pos ? (busy() | (m_wel << 1)) : 0xFF;
+            
+        case 0x9F:                                          // JEDEC ID
+            return m_pos ? jedec >> ((2 - (m_pos - 1) % 3) * 8) : 0xFF;
+            
+        case 0x03:                                          // READ
+            return m_pos >= 4 ? mem[(m_addr + m_pos - 4) & (size - 1)] : 0xFF;
+            
+        case 0x0B:                                          // FAST_READ, one dummy byte
+            return m_pos >= 5 ? mem[(m_addr + m_pos - 5) & (size - 1)] : 0xFF;
+            
+        default:
+            return 0xFF;
+    }
+}
+
+
+void SimSPIFlashSlave::write(uint8_t byte)
+{
+    if (m_pos == 0)
+    {
+        m_pos = 1;
+        m_cmd = byte;
+        
+        if (busy() && byte != 0x05)
+        {
+            busyIgnored++;
+            m_cmd = 0xFF;                                   // Ignore the rest of the frame
+        }
+        else if (byte == 0x06)
+            m_wel = 1;                                      // WREN
+        else if (byte == 0x04)
+            m_wel = 0;                                      // WRDI
+        else if ((byte == 0xC7 || byte == 0x60) && m_wel)
+            m_pending = 1;                                  // Chip erase
+        return;
+    }
+    
+    if (m_pos < 4)
+    {
+        m_addr = (m_addr << 8) | byte;
+        if (++m_pos == 4 && (m_cmd == 0x20 || m_cmd == 0xD8) && m_wel)
+            m_pending = 1;                                  // Sector / block erase
+        return;
+    }
+    
+    if (m_cmd == 0x02 && m_wel)
+    {   // Page program wraps inside the page and only clears bits
+        uint32_t a = (m_addr & ~0xFFUL) | ((m_addr + m_pos - 4) & 0xFF);
+        mem[a & (size - 1)] &= byte;
+        m_pending = 1;
+    }
+    m_pos++;
+}
+
+
+void SimSPIFlashSlave::deselect()
+{
+    uint32_t len;
+    
+    if (!m_pending)
+        return;
+    
+    if (m_cmd == 0x02)
+    {
+        programs++;
+        m_busyUntil = CNT + programTicks;
+    }
+    else
+    {
+        len = (m_cmd == 0x20) ? 4096 : (m_cmd == 0xD8) ? 65536 : size;
+        if (len > size)
+            len = size;
+        memset(mem + (m_addr & (size - 1) & ~(len - 1)), 0xFF, len);
+        erases++;
+        m_busyUntil = CNT + eraseTicks;
+    }
+    
+    if (m_busyUntil == 0)
+        m_busyUntil = 1;
+    m_wel     = 0;
+    m_pending = 0;
+}
+
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
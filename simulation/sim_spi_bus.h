@@ -0,0 +1,249 @@
+/*
+ * Bit level virtual SPI bus and slave devices for the host simulation.
+ */
+
+#ifndef __SIM_SPI_BUS_H__
+#define __SIM_SPI_BUS_H__
+
+#include "sim_pins.h"
+
+
+/** @brief A device on the virtual SPI bus.
+ *
+ *  The bus shifts bits and talks to a selected slave a byte at a time.  
+ *  read() gives the byte to shift out next, before the byte coming in with
+ *  it is known, as on real parts.  Override the hooks to model a device.
+ */
+class SimSPISlave
+{
+public:
+    virtual ~SimSPISlave() {};
+    
+    virtual void    select() {};                // CS went active
+    virtual uint8_t read() { return 0xFF; };    // Next byte for the master
+    virtual void    write(uint8_t byte) {};     // Byte from the master
+    virtual void    deselect() {};              // CS went inactive
+};
+
+
+/** @brief 8 bit shift register, e.g. a 74HC595 with its output read back.
+ *
+ *  Every byte shifted in comes back out during the next byte, so a chain of
+ *  them passes data along one byte per device.  [value] is the byte latched
+ *  when CS goes inactive.
+ */
+class SimSPIShiftSlave : public SimSPISlave
+{
+public:
+    SimSPIShiftSlave() : value(0), m_shift(0) {};
+    
+    uint8_t         read()              { return m_shift; };
+    void            write(uint8_t byte) { m_shift = byte; };
+    void            deselect()          { value = m_shift; };
+    
+    uint8_t         value;          // Latched output
+    
+protected:
+    uint8_t         m_shift;        // Shift register contents
+};
+
+
+/** @brief Daisy chain of slaves sharing one CS line, MOSI into device 0.
+ *
+ *  Each CS frame shifts one byte per device through the chain.  At select 
+ *  every device's next output byte is loaded into its stage, and at 
+ *  deselect every device is handed the byte left in its stage, the way 
+ *  parts such as the L6470 latch a chain.  Attach devices in chain order.
+ */
+class SimSPIChainSlave : public SimSPISlave
+{
+public:
+    SimSPIChainSlave() : m_n(0) {};
+    
+    void            add(SimSPISlave* dev);
+    void            select();
+    uint8_t         read();
+    void            write(uint8_t byte);
+    void            deselect();
+    
+protected:
+    SimSPISlave*    m_devs[8];
+    uint8_t         m_stage[8];     // Shift register of each device
+    int             m_n;
+};
+
+
+// L6470 register addresses
+enum SIM_L6470_REG
+{
+    SIM_L6470_ABS_POS = 0x01, SIM_L6470_EL_POS, SIM_L6470_MARK, SIM_L6470_SPEED,
+    SIM_L6470_ACC, SIM_L6470_DEC, SIM_L6470_MAX_SPEED, SIM_L6470_MIN_SPEED,
+    SIM_L6470_KVAL_HOLD, SIM_L6470_KVAL_RUN, SIM_L6470_KVAL_ACC, SIM_L6470_KVAL_DEC,
+    SIM_L6470_INT_SPEED, SIM_L6470_ST_SLP, SIM_L6470_FN_SLP_ACC, SIM_L6470_FN_SLP_DEC,
+    SIM_L6470_K_THERM, SIM_L6470_ADC_OUT, SIM_L6470_OCD_TH, SIM_L6470_STALL_TH,
+    SIM_L6470_FS_SPD, SIM_L6470_STEP_MODE, SIM_L6470_ALARM_EN, SIM_L6470_CONFIG,
+    SIM_L6470_STATUS, SIM_L6470_REGS
+};
+
+// L6470 STATUS bits used by the model
+#define SIM_L6470_HIZ           0x0001
+#define SIM_L6470_BUSY          0x0002      // Active low
+#define SIM_L6470_DIR           0x0010
+#define SIM_L6470_MOT_STATUS    0x0060
+#define SIM_L6470_NOTPERF_CMD   0x0080
+#define SIM_L6470_WRONG_CMD     0x0100
+
+
+/** @brief Register and command model of an ST L6470 stepper driver.
+ *
+ *  Decodes the command set a byte per CS frame, as the part does, and 
+ *  keeps the register file with the real widths and reset values.  Motion
+ *  completes at once: Move and GoTo update ABS_POS, Run sets SPEED and the
+ *  stops clear it.  GetParam and GetStatus answers come out over the next
+ *  bytes.  Bad commands and writes to read-only registers set the STATUS
+ *  flags the datasheet lists, cleared by GetStatus.
+ */
+class SimSPIL6470Slave : public SimSPISlave
+{
+public:
+    SimSPIL6470Slave()  { reset(); };
+    
+    uint8_t         read();
+    void            write(uint8_t byte);
+    void            reset();
+    
+    uint32_t        regs[SIM_L6470_REGS];   // Register file, index by SIM_L6470_REG
+    uint32_t        commands;               // Commands decoded
+    
+protected:
+    uint8_t         m_cmd;          // Command waiting for argument bytes
+    int             m_args;         // Argument bytes still expected
+    uint32_t        m_value;        // Argument assembled so far
+    uint8_t         m_out[3];       // Response bytes, first in m_out[0]
+    int             m_outLen;       // Response bytes left
+    
+    void            execute();
+    void            motion(uint8_t cmd);
+    void            respond(uint32_t value, int bytes);
+};
+
+
+/** @brief 25xx style SPI NOR flash.
+ *
+ *  READ (0x03), FAST_READ (0x0B), WREN/WRDI, RDSR, PAGE PROGRAM (0x02) 
+ *  wrapping in 256 byte pages, 4K/64K sector and chip erase and JEDEC ID
+ *  (0x9F).  Programming only clears bits and needs WREN first.  Program and
+ *  erase start at CS rise and keep WIP set for [programTicks] or 
+ *  [eraseTicks], ignoring everything but RDSR meanwhile.
+ */
+class SimSPIFlashSlave : public SimSPISlave
+{
+public:
+    SimSPIFlashSlave(uint32_t size = 1 << 20, uint32_t jedec = 0xEF4014,
+                     uint32_t programTicks = 56000, uint32_t eraseTicks = 3600000);
+    ~SimSPIFlashSlave();
+    
+    void            select();
+    uint8_t         read();
+    void            write(uint8_t byte);
+    void            deselect();
+    
+    uint8_t*        mem;            // Contents, [size] bytes erased to 0xFF
+    uint32_t        size;           // Capacity in bytes (power of 2)
+    uint32_t        jedec;          // Manufacturer, type and capacity ID
+    uint32_t        programTicks;   // Page program time (56000 = 0.7ms)
+    uint32_t        eraseTicks;     // Erase time of any size (3600000 = 45ms)
+    uint32_t        programs;       // Page programs run
+    uint32_t        erases;         // Erases run
+    uint32_t        busyIgnored;    // Commands ignored while busy
+    
+protected:
+    uint8_t         m_cmd;          // Command of the current frame
+    int             m_pos;          // Bytes received in the current frame
+    uint32_t        m_addr;         // Address of the current frame
+    int             m_wel;          // Write enable latch
+    int             m_pending;      // Program or erase to run at CS rise
+    uint32_t        m_busyUntil;    // CNT the write in progress ends
+    
+    int             busy();
+};
+
+
+// Traffic counters kept by the bus
+typedef struct SIM_SPI_STATS
+{
+    uint32_t selects;               // CS frames
+    uint32_t bytes;                 // Whole bytes exchanged
+    uint32_t edges;                 // SCLK edges seen by a selected slave
+    uint32_t ticks;                 // CNT ticks from each CS going active to its last SCLK edge
+} SIM_SPI_STATS;
+
+
+/** @brief SPI bus on three simulated pins plus a CS pin per slave.
+ *
+ *  Decodes SCLK edges for each selected slave in that slave's mode and 
+ *  drives MISO for it.  MISO is modelled open drain with a pull-up, and the
+ *  CS pins are pulled up so slaves stay deselected until a cog drives them.
+ *  The edge and tick counts let a check confirm SCLK never ran faster than 
+ *  it was set to.
+ */
+class SimSPIBus : public SimPinDevice
+{
+public:
+    SimSPIBus(int sck, int mosi, int miso);
+    ~SimSPIBus();
+    
+    void            attach(SimSPISlave* slave, int cs, int mode = 0);
+    void            update(uint32_t lines, uint32_t cnt);
+    void            getStats(SIM_SPI_STATS* stats);
+    void            resetStats();
+    
+protected:
+    typedef struct SLOT
+    {
+        SimSPISlave*    slave;
+        uint32_t        cs;         // CS pin mask
+        int             mode;       // SPI mode 0-3
+        int             selected;
+        int             bits;       // Bits received of the current byte
+        uint8_t         in;         // Byte coming in
+        uint8_t         out;        // Byte going out, next bit in bit 7
+        int             low;        // Holding MISO low
+        uint32_t        mark;       // CNT of the select or the last SCLK edge since
+    } SLOT;
+    
+    uint32_t        m_sck;          // SCLK pin mask
+    uint32_t        m_mosi;         // MOSI pin mask
+    uint32_t        m_miso;         // MISO pin mask
+    uint32_t        m_lines;        // Levels seen on the last update
+    SLOT            m_slots[8];
+    int             m_nslots;
+    SIM_SPI_STATS   m_stats;
+    
+    void            clock(SLOT& s, int sck, int mosi, uint32_t cnt);
+    void            shiftOut(SLOT& s);
+};
+
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+#endif
@@ -0,0 +1,1526 @@
+/*
+ *   test_sim.cpp - Regression checks for the bus classes against the host simulation.
+ *   Each check that fails prints its file, line and expression, and the exit status
+ *   is the number of failed checks, so it can run unattended in CI.  Build it like
+ *   any other simulation program (see propeller.h) and run:
+ *
+ *     test_sim [-v]
+ *
+ *       -v   print every check, not only the failures
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "i2c.h"
+#include "i2c_bench.h"
+#include "i2c_eeprom.h"
+#include "i2c_regcache.h"
+#include "i2c_regmap.h"
+#include "spi.h"
+#include "spi_chain.h"
+#include "spi_stream.h"
+#include "sim_i2c_bus.h"
+#include "sim_spi_bus.h"
+#include "sim_spi.h"
+
+#define TEST_SCL    28
+#define TEST_SDA    29
+#define TEST_SCK    0
+#define TEST_MOSI   1
+#define TEST_MISO   2
+#define TEST_CS     4
+
+#define FREQ_TOLERANCE  40      // Percent the host sim's achieved SCL rate may fall short
+
+#define CHECK(expr) check((expr) ? 1 : 0, #expr, __FILE__, __LINE__)
+
+static int s_failed;
+static int s_checks;
+static int s_verbose;
+
+static void check(int ok, const char* expr, const char* file, int line)
+{
+    s_checks++;
+    if (!ok)
+        s_failed++;
+    if (!ok || s_verbose)
+        printf("%s:%d: %s %s\n", file, line, ok ? "ok  " : "FAIL", expr);
+}
+
+
+/* Answers each byte with the previous one inverted, 0x5A first in a frame */
+class EchoSlave : public SimSPISlave
+{
+public:
+    EchoSlave() : count(0), m_last(0x5A) {};
+
+    void            select()            { m_last = 0x5A; };
+    uint8_t         read()              { return m_last; };
+    void            write(uint8_t byte) { m_last = byte ^ 0xFF; count++; };
+
+    int             count;          // Bytes received
+
+protected:
+    uint8_t         m_last;
+};
+
+
+/* Counts the bytes received and how many broke the n * 7 pattern */
+class PatternSlave : public SimSPISlave
+{
+public:
+    PatternSlave() : count(0), bad(0) {};
+
+    void            write(uint8_t byte) { if (byte != (uint8_t)(count * 7)) bad++; count++; };
+
+    uint32_t        count;
+    uint32_t        bad;
+};
+
+
+/* Register file that stamps each STOP addressed to it from a clock shared
+   with other slaves, so the order transactions finished in can be read back */
+class StampSlave : public SimI2CRegisterSlave
+{
+public:
+    StampSlave(uint8_t adr, int* clock) : SimI2CRegisterSlave(adr, 256, 1), n(0), m_clock(clock) {};
+
+    void            stop()          { if (n < 8) stamps[n++] = ++*m_clock; };
+
+    int             stamps[8];      // Clock value at each STOP
+    int             n;
+
+protected:
+    int*            m_clock;
+};
+
+
+/* A slave left mid byte by a master reset, holding SDA low for the zero bits
+   it still has to send.  It moves to its next bit on each falling SCL edge
+   and lets go at the ACK slot, which belongs to the master. */
+class StuckSlave : public SimPinDevice
+{
+public:
+    StuckSlave(int scl, int sda) : pulses(0), m_scl(1u << scl), m_sda(1u << sda), m_left(0), m_clk(1)
+                        { sim_attach(this); };
+    ~StuckSlave()       { sim_detach(this); };
+
+    void            hold(int bits)  { pulses = 0; m_clk = 1; m_left = bits; m_pullLow = bits ? m_sda : 0; };
+
+    void            update(uint32_t lines, uint32_t cnt)
+    {
+        int clk = (lines & m_scl) != 0;
+        if (m_clk && !clk && m_left > 0)
+        {
+            pulses++;
+            m_left--;
+        }
+        m_clk     = clk;
+        m_pullLow = m_left ? m_sda : 0;
+    };
+
+    volatile int    pulses;         // SCL pulses clocked while holding SDA
+
+protected:
+    uint32_t        m_scl;
+    uint32_t        m_sda;
+    volatile int    m_left;         // Bits still to send, counting the one on SDA
+    int             m_clk;          // SCL level on the last update
+};
+
+
+/* A sensor's data ready output, pulled up and driven low while not [level] */
+class DrdyPin : public SimPinDevice
+{
+public:
+    DrdyPin(int pin) : level(0), seen(0), m_mask(1u << pin) { sim_set_pullup(m_mask, 1); sim_attach(this); };
+    ~DrdyPin()          { sim_detach(this); sim_set_pullup(m_mask, 0); };
+
+    void            update(uint32_t lines, uint32_t cnt)
+    {
+        m_pullLow = level ? 0 : m_mask;
+        if (((lines & m_mask) != 0) == (level != 0))
+            seen++;
+    };
+
+    // Change the level and give the cog up to 100ms of CNT to read it, so a
+    // pulse is never shorter than the host lets the cog run
+    void            drive(int high)
+    {
+        uint32_t start = CNT;
+        seen  = 0;
+        level = high;
+        while (seen < 2 && CNT - start < CLKFREQ / 10)
+            usleep(100);
+    };
+
+    volatile int    level;          // Pin level the sensor is driving
+    volatile int    seen;           // Pin reads that found it at [level]
+
+protected:
+    uint32_t        m_mask;
+};
+
+
+/* Let [us] microseconds of CNT go by, however long the host takes over it */
+static void waitUs(uint32_t us)
+{
+    uint32_t start = CNT;
+
+    while (CNT - start < (CLKFREQ / 1000000) * us)
+        usleep(100);
+}
+
+
+/* A register device on the test pins and a bus handle opened on it */
+class I2CFixture
+{
+public:
+    I2CFixture(uint8_t adr, int size = 256, int regBytes = 1)
+        : bus(TEST_SCL, TEST_SDA), dev(adr, size, regBytes), i2c(TEST_SCL, TEST_SDA, 400000)
+    {
+        bus.attach(&dev);
+        i2c.setWaitStrategy(I2C_WAIT_YIELD);
+        i2c.openBus(adr);
+    };
+
+    SimI2CBus           bus;
+    SimI2CRegisterSlave dev;
+    I2C                 i2c;
+};
+
+
+static void testI2C()
+{
+    I2CFixture f(0x50);
+    CHECK(f.i2c.isReady());
+
+    uint8_t w[4] = { 0x11, 0x22, 0x33, 0x44 };
+    uint8_t r[4] = { 0 };
+    CHECK(f.i2c.tx(0x10, w, 4) == 0);
+    CHECK(f.dev.regs[0x10] == 0x11 && f.dev.regs[0x13] == 0x44);
+    CHECK(f.i2c.rx(0x10, r, 4) == 0);
+    CHECK(memcmp(w, r, 4) == 0);
+    CHECK((uint16_t)f.i2c.rxWord(0x11) == 0x2233);
+
+    // Plain buffer transfers go through the bus's own scratch segment
+    uint8_t p[3] = { 0x20, 0xA5, 0x5A };
+    CHECK(f.i2c.tx(p, 3) == 0);
+    CHECK(f.dev.regs[0x20] == 0xA5 && f.dev.regs[0x21] == 0x5A);
+
+    CHECK(f.i2c.devPresent(0x50) == 1);
+    CHECK(f.i2c.devPresent(0x51) == 0);
+
+    uint32_t map[4];
+    CHECK(f.i2c.scan(map, 5, 200) < 0);
+    CHECK(f.i2c.scan(map, 0x50, 0x50) == 1);
+
+    I2C_BATCH_ENTRY e[2];
+    uint8_t a[3], b[2];
+    f.i2c.setBatchEntry(e[0], 0x50, 0x10, a, 3);
+    f.i2c.setBatchEntry(e[1], 0x50, 0x20, b, 2);
+    CHECK(f.i2c.batch(e, 2) == 0);
+    CHECK(a[0] == 0x11 && a[2] == 0x33 && b[0] == 0xA5 && b[1] == 0x5A);
+}
+
+
+static void testBusFreq()
+{
+    SimI2CBus bus(TEST_SCL, TEST_SDA);
+    SimI2CRegisterSlave dev(0x50, 16, 1);
+    bus.attach(&dev);
+
+    // With no device stretching the clock the cog drops the SCL checks from
+    // its bit loop and calibrates towards I2C_FREQ_MAX.  It never runs faster
+    // than asked, and on the host, where every pin access costs far more than
+    // a cog instruction, gets within FREQ_TOLERANCE percent of the request.  
+    // A loaded host can preempt the calibration byte, so up to ten buses are
+    // started to find one that was timed undisturbed.
+    int best = 0;
+    for (int i = 0; i < 10 && best < I2C_FREQ_MAX / 100 * (100 - FREQ_TOLERANCE); i++)
+    {
+        I2C i2c(TEST_SCL, TEST_SDA, I2C_FREQ_MAX, 0);
+        i2c.setWaitStrategy(I2C_WAIT_YIELD);
+        i2c.openBus(0x50);
+        CHECK(i2c.isReady());
+        CHECK(i2c.getBusFreq() <= I2C_FREQ_MAX);
+        if (i2c.getBusFreq() > best)
+            best = i2c.getBusFreq();
+
+        uint8_t w[4] = { 0xDE, 0xAD, (uint8_t)i, 0xEF }, r[4] = { 0 };
+        CHECK(i2c.tx(0x04, w, 4) == 0 && i2c.rx(0x04, r, 4) == 0);
+        CHECK(memcmp(w, r, 4) == 0);
+    }
+    CHECK(best >= I2C_FREQ_MAX / 100 * (100 - FREQ_TOLERANCE));
+}
+
+
+static void testBench()
+{
+    SimI2CBus bus(TEST_SCL, TEST_SDA);
+    SimI2CRegisterSlave dev(0x50, 256, 1);
+    bus.attach(&dev);
+    I2C i2c(TEST_SCL, TEST_SDA, I2C_FREQ_MAX, 0);
+    i2c.openBus(0x50);
+
+    // Wire time is what the bits take at the rate achieved, not the one asked
+    // for: 16 data bytes, the address and one register byte plus START/STOP
+    I2CBench bench(TEST_SCL, TEST_SDA, 0x50);
+    I2C_BENCH_RESULT res;
+    res.freq = I2C_FREQ_MAX;
+    CHECK(bench.runCase(i2c, 16, 1, I2C_BENCH_WRITE, 4, &res) == 0);
+    CHECK(res.scl_freq == i2c.getBusFreq() && res.txns == 4 && res.errors == 0);
+    CHECK(res.wire_ticks == (uint32_t)(164ull * CLKFREQ / res.scl_freq));
+    CHECK(res.overhead == (res.ticks > res.wire_ticks ? res.ticks - res.wire_ticks : 0));
+}
+
+
+static void testInventory()
+{
+    I2CFixture f(0x50);
+    SimI2CRegisterSlave late(0x68, 16, 1);
+    SIM_I2C_STATS st;
+    I2C proxy(f.i2c);
+    uint32_t map[I2C_SCAN_WORDS];
+
+    // The first lookup on a fresh bus scans once, later ones stay off the bus
+    f.bus.resetStats();
+    CHECK(proxy.isPresent(0x50) == 1);
+    f.bus.getStats(&st);
+    CHECK(st.stops == I2C_SCAN_LAST - I2C_SCAN_FIRST + 1u);
+
+    f.bus.resetStats();
+    CHECK(proxy.isPresent(0x50) == 1 && f.i2c.isPresent(0x68) == 0);
+    CHECK(f.i2c.getInventory(map) == 0);
+    CHECK(map[0x50 >> 5] == 1u << (0x50 & 31));
+    f.bus.getStats(&st);
+    CHECK(st.starts == 0 && st.bytes == 0);
+
+    // A device plugged in later shows up for every proxy once the owner rescans
+    f.bus.attach(&late);
+    CHECK(proxy.isPresent(0x68) == 0);
+    CHECK(f.i2c.refreshInventory() == 2);
+    f.bus.resetStats();
+    CHECK(proxy.isPresent(0x68) == 1 && proxy.isPresent(0x50) == 1);
+    CHECK(proxy.getInventory(map) == 0 && map[0x68 >> 5] == (1u << (0x68 & 31)));
+    f.bus.getStats(&st);
+    CHECK(st.starts == 0 && st.bytes == 0);
+    CHECK(proxy.isPresent(128) == 0);
+}
+
+
+static void testSeg()
+{
+    I2CFixture f(0x50);
+
+    // Odd sized pieces from different places go out as one data phase
+    uint8_t hdr[3] = { 0x01, 0x02, 0x03 };
+    uint8_t body[5] = { 0xA1, 0xA2, 0xA3, 0xA4, 0xA5 };
+    I2C_SEGMENT w[3] = { { hdr, 3 }, { body, 0 }, { body, 5 } };
+    CHECK(f.i2c.txSeg(0x40, w, 3) == 0);
+    CHECK(f.dev.regs[0x40] == 0x01 && f.dev.regs[0x42] == 0x03);
+    CHECK(f.dev.regs[0x43] == 0xA1 && f.dev.regs[0x47] == 0xA5 && f.dev.regs[0x48] == 0);
+
+    // and come back split at a different place
+    uint8_t a[5] = { 0 }, b[3] = { 0 };
+    I2C_SEGMENT r[2] = { { a, 5 }, { b, 3 } };
+    CHECK(f.i2c.rxSeg(0x40, r, 2) == 0);
+    CHECK(a[0] == 0x01 && a[3] == 0xA1 && a[4] == 0xA2);
+    CHECK(b[0] == 0xA3 && b[2] == 0xA5);
+
+    // Async handles leave the lists in the caller's memory until waited on
+    uint8_t c[1] = { 0x77 }, d[1] = { 0 }, e[7] = { 0 };
+    I2C_SEGMENT wc[2] = { { c, 1 }, { body, 1 } };
+    I2C_SEGMENT rd[2] = { { d, 1 }, { e, 7 } };
+    int h = f.i2c.txSegAsync(0x47, wc, 2);
+    CHECK(f.i2c.wait(h) == 0);
+    h = f.i2c.rxSegAsync(0x41, rd, 2);
+    CHECK(f.i2c.wait(h) == 0);
+    CHECK(d[0] == 0x02 && e[0] == 0x03 && e[5] == 0x77 && e[6] == 0xA1);
+
+    CHECK(f.i2c.txSeg(0x40, w, 0) < 0);
+}
+
+
+static void testWords()
+{
+    I2CFixture f(0x50);
+
+    // Words go out in the device's order and the caller's copy comes back as it was
+    int16_t w[3] = { 0x1234, -2, (int16_t)0x8001 };
+    CHECK(f.i2c.txWords(0x10, w, 3) == 0);
+    CHECK(w[0] == 0x1234 && w[1] == -2 && w[2] == (int16_t)0x8001);
+    CHECK(f.dev.regs[0x10] == 0x12 && f.dev.regs[0x11] == 0x34);
+    CHECK(f.dev.regs[0x12] == 0xFF && f.dev.regs[0x13] == 0xFE);
+    CHECK(f.dev.regs[0x14] == 0x80 && f.dev.regs[0x15] == 0x01);
+
+    CHECK(f.i2c.txWords(0x20, w, 3, I2C_REG_LSB_FIRST) == 0);
+    CHECK(w[0] == 0x1234 && w[1] == -2 && w[2] == (int16_t)0x8001);
+    CHECK(f.dev.regs[0x20] == 0x34 && f.dev.regs[0x21] == 0x12);
+    CHECK(f.dev.regs[0x24] == 0x01 && f.dev.regs[0x25] == 0x80);
+
+    // Read back in either order, negative values keep their sign
+    int16_t r[3] = { 0 };
+    CHECK(f.i2c.rxWords(0x10, r, 3) == 0);
+    CHECK(r[0] == 0x1234 && r[1] == -2 && r[2] == -32767);
+    memset(r, 0, sizeof(r));
+    CHECK(f.i2c.rxWords(0x20, r, 3, I2C_REG_LSB_FIRST) == 0);
+    CHECK(r[0] == 0x1234 && r[1] == -2 && r[2] == -32767);
+    CHECK(f.i2c.rxWords(0x20, r, 1) == 0 && r[0] == 0x3412);
+
+    int32_t l[2] = { 0x12345678, -100000 };
+    CHECK(f.i2c.txLongs(0x30, l, 2) == 0);
+    CHECK(l[0] == 0x12345678 && l[1] == -100000);
+    CHECK(f.dev.regs[0x30] == 0x12 && f.dev.regs[0x33] == 0x78);
+    CHECK(f.dev.regs[0x34] == 0xFF && f.dev.regs[0x35] == 0xFE && f.dev.regs[0x36] == 0x79 && f.dev.regs[0x37] == 0x60);
+
+    CHECK(f.i2c.txLongs(0x40, l, 2, I2C_REG_LSB_FIRST) == 0);
+    CHECK(l[0] == 0x12345678 && l[1] == -100000);
+    CHECK(f.dev.regs[0x40] == 0x78 && f.dev.regs[0x43] == 0x12 && f.dev.regs[0x47] == 0xFF);
+
+    int32_t q[2] = { 0 };
+    CHECK(f.i2c.rxLongs(0x30, q, 2) == 0);
+    CHECK(q[0] == 0x12345678 && q[1] == -100000);
+    memset(q, 0, sizeof(q));
+    CHECK(f.i2c.rxLongs(0x40, q, 2, I2C_REG_LSB_FIRST) == 0);
+    CHECK(q[0] == 0x12345678 && q[1] == -100000);
+
+    // A single long goes out MSB first, as the interface declares, and comes
+    // back with its sign.  Taken LSB first through the array helpers it reads
+    // byte swapped, and a count of one round trips in that order too.
+    CHECK(f.i2c.txLong(0x50, 0x89ABCDEF) == 0);
+    CHECK(f.dev.regs[0x50] == 0x89 && f.dev.regs[0x51] == 0xAB && f.dev.regs[0x53] == 0xEF);
+    CHECK(f.i2c.rxLong(0x50) == (int32_t)0x89ABCDEF);
+    q[0] = 0;
+    CHECK(f.i2c.rxLongs(0x50, q, 1, I2C_REG_LSB_FIRST) == 0 && q[0] == (int32_t)0xEFCDAB89);
+
+    int32_t one = -2;
+    CHECK(f.i2c.txLongs(0x58, &one, 1, I2C_REG_LSB_FIRST) == 0 && one == -2);
+    CHECK(f.dev.regs[0x58] == 0xFE && f.dev.regs[0x5B] == 0xFF);
+    q[0] = 0;
+    CHECK(f.i2c.rxLongs(0x58, q, 1, I2C_REG_LSB_FIRST) == 0 && q[0] == -2);
+    CHECK(f.i2c.rxLong(0x58) == (int32_t)0xFEFFFFFF);
+
+    // A failed write still hands the values back unchanged
+    f.i2c.openBus(0x51);
+    CHECK(f.i2c.txWords(0x10, w, 3) < 0);
+    CHECK(w[0] == 0x1234 && w[1] == -2 && w[2] == (int16_t)0x8001);
+    CHECK(f.i2c.txLongs(0x30, l, 2, I2C_REG_LSB_FIRST) < 0);
+    CHECK(l[0] == 0x12345678 && l[1] == -100000);
+}
+
+
+static void testRegBytes()
+{
+    // A file of 251 registers folds every address byte it is sent into the
+    // pointer, so where data lands shows the whole address arrived
+    I2CFixture f(0x50, 251, 4);
+    f.i2c.setRegBytes(4);
+    uint8_t w[4] = { 0xC1, 0xC2, 0xC3, 0xC4 }, r[4] = { 0 };
+
+    CHECK(f.i2c.tx(0x12345678, w, 4) == 0);
+    CHECK(f.dev.regs[0x12345678 % 251] == 0xC1 && f.dev.regs[(0x12345678 + 3) % 251] == 0xC4);
+    CHECK(f.i2c.rx(0x12345678, r, 4) == 0 && memcmp(w, r, 4) == 0);
+    CHECK(f.dev.regs[0x00345678 % 251] == 0);
+
+    // A low register still gets all four bytes, not one with the data eaten
+    // as the rest of the address
+    CHECK(f.i2c.tx(0x10, w, 2) == 0);
+    CHECK(f.dev.regs[0x10] == 0xC1 && f.dev.regs[0x11] == 0xC2);
+    memset(r, 0, 4);
+    CHECK(f.i2c.rx(0x10, r, 2) == 0 && r[0] == 0xC1 && r[1] == 0xC2);
+
+    // A 3 byte addressed memory, written across a page boundary above and
+    // below 64K, is split there and each page ACK polled through its cycle
+    SimI2CBus bus(TEST_SCL - 2, TEST_SDA - 2);
+    SimI2CEepromSlave mem(0x50, 131072, 3, 256, 80000);
+    bus.attach(&mem);
+    I2C i2c(TEST_SCL - 2, TEST_SDA - 2, 400000);
+    i2c.setWaitStrategy(I2C_WAIT_YIELD);
+    i2c.openBus(0x50);
+    i2c.setRegBytes(3);
+    CHECK(i2c.setPageSize(256) == 0);
+
+    uint8_t d[16], q[16];
+    for (int i = 0; i < 16; i++)
+        d[i] = 0x40 + i;
+    static const uint32_t at[2] = { 0x100F8, 0x0000F8 };
+    for (int k = 0; k < 2; k++)
+    {
+        mem.writeCycles = 0;
+        CHECK(i2c.tx(at[k], d, 16) == 0);
+        CHECK(mem.writeCycles == 2);
+        CHECK(memcmp(&mem.regs[at[k]], d, 16) == 0);
+        CHECK(mem.regs[at[k] - 1] == 0 && mem.regs[at[k] + 16] == 0);
+
+        // The last page is still programming when tx() returns
+        waitUs(2000);
+        memset(q, 0, 16);
+        CHECK(i2c.rx(at[k], q, 16) == 0 && memcmp(q, d, 16) == 0);
+    }
+}
+
+
+static void testI2CFaults()
+{
+    I2CFixture f(0x50);
+
+    uint8_t w[4] = { 0x11, 0x22, 0x33, 0x44 };
+    uint8_t r[4] = { 0 };
+    SIM_I2C_STATS st;
+
+    // A NACKed address fails the header and never reaches the registers
+    f.dev.nackAddress = 1;
+    CHECK(f.i2c.tx(0x40, w, 4) < 0);
+    CHECK(f.i2c.getStatus() == I2C_ERR_SEND_HDR);
+    CHECK(f.i2c.rx(0x40, r, 4) < 0);
+    CHECK(f.i2c.getStatus() == I2C_ERR_SEND_HDR);
+    CHECK(f.i2c.devPresent(0x50) == 0);
+    CHECK(f.dev.regs[0x40] == 0);
+    f.dev.nackAddress = 0;
+
+    // NACK after the register byte and one data byte
+    f.bus.resetStats();
+    f.dev.nackAfter = 2;
+    CHECK(f.i2c.tx(0x40, w, 4) < 0);
+    CHECK(f.i2c.getStatus() == I2C_ERR_SEND);
+    CHECK(f.dev.regs[0x40] == 0x11 && f.dev.regs[0x41] == 0);
+    f.bus.getStats(&st);
+    CHECK(st.nacks == 1 && st.stops == 1);
+    f.dev.nackAfter = -1;
+
+    // A short address phase leaves the pointer inside the file
+    SimI2CRegisterSlave wide(0x51, 16, 4);
+    f.bus.attach(&wide);
+    f.i2c.openBus(0x51);
+    CHECK(f.i2c.tx(-1, w, 1) == 0);
+    CHECK(f.i2c.rx(-1, r, 4) == 0);
+
+    // Stretching after every byte slows the bus but loses nothing
+    f.i2c.openBus(0x50);
+    f.bus.resetStats();
+    f.dev.stretch = 800;
+    CHECK(f.i2c.tx(0x48, w, 4) == 0);
+    CHECK(f.i2c.rx(0x48, r, 4) == 0);
+    CHECK(memcmp(w, r, 4) == 0);
+    f.bus.getStats(&st);
+    CHECK(st.stretches >= 10 && st.nacks == 0);
+
+    // A slave that never lets go of SCL is given up on after about 31ms, the
+    // bus is reset behind it and the next transaction goes through
+#ifdef I2C_DRIVER_STATS
+    I2C_STATS ds;
+    CHECK(f.i2c.resetStats() == 0);
+#endif
+    f.dev.stretch = SIM_STRETCH_FOREVER;
+    uint32_t start = CNT;
+    CHECK(f.i2c.tx(0x48, w, 4) < 0);
+    uint32_t took = CNT - start;
+    CHECK(f.i2c.getStatus() == I2C_ERR_TIMEOUT);
+    CHECK(took >= (CLKFREQ >> I2C_STRETCH_WAIT_SHIFT) && took < 2 * (CLKFREQ >> I2C_STRETCH_WAIT_SHIFT));
+    f.dev.stretch = 0;
+    f.bus.releaseScl();
+    memset(r, 0, 4);
+    CHECK(f.i2c.tx(0x48, w, 4) == 0);
+    CHECK(f.i2c.rx(0x48, r, 4) == 0);
+    CHECK(memcmp(w, r, 4) == 0);
+
+    // The cog's counters saw all three, and only the timeout as an error
+#ifdef I2C_DRIVER_STATS
+    CHECK(f.i2c.getStats(&ds) == 0);
+    CHECK(ds.txns == 3 && ds.errors == 1);
+    CHECK(ds.stretch_timeouts == 1 && ds.recoveries == 1);
+    CHECK(ds.bytes == 8 && ds.nacks[0x50] == 0);
+    CHECK(ds.min_ticks <= ds.max_ticks && ds.max_ticks >= (CLKFREQ >> I2C_STRETCH_WAIT_SHIFT));
+
+    // A NACK is an error charged to the address, not a timeout
+    f.dev.nackAfter = 2;
+    CHECK(f.i2c.tx(0x40, w, 4) < 0);
+    f.dev.nackAfter = -1;
+    CHECK(f.i2c.getStats(&ds) == 0);
+    CHECK(ds.txns == 4 && ds.errors == 2 && ds.stretch_timeouts == 1);
+    CHECK(ds.nacks[0x50] == 1);
+
+    CHECK(f.i2c.resetStats() == 0);
+    CHECK(f.i2c.getStats(&ds) == 0);
+    CHECK(ds.txns == 0 && ds.errors == 0 && ds.recoveries == 0 && ds.nacks[0x50] == 0);
+#else
+    I2C_STATS ds;
+    CHECK(f.i2c.getStats(&ds) < 0);
+    CHECK(f.i2c.resetStats() < 0);
+#endif
+}
+
+
+/* One producer cog sharing a bus through its own proxy */
+typedef struct PRODUCER
+{
+    I2C*        bus;            // Proxy for this producer
+    uint8_t     reg;            // First register of its own block
+    int         bad;            // Transfers that failed or read back wrong
+    int         expired;        // Handles lost to slot reuse and run again
+} PRODUCER;
+
+
+static void* producer(void* arg)
+{
+    PRODUCER *p = (PRODUCER *)arg;
+
+    for (int i = 0; i < 40; i++)
+    {
+        uint8_t w[4] = { p->reg, (uint8_t)i, (uint8_t)~i, 0x5A };
+        uint8_t r[4] = { 0 };
+        int rc;
+
+        // A producer the host keeps off the CPU while the other runs a whole
+        // ring of commands finds its handle expired, as documented, and simply
+        // runs the transfer again
+        while ((rc = p->bus->wait(p->bus->txAsync(p->reg, w, 4))) != 0 &&
+               p->bus->getStatus() == I2C_ERR_EXPIRED)
+            p->expired++;
+        if (rc == 0)
+            while ((rc = p->bus->rx(p->reg, r, 4)) != 0 && p->bus->getStatus() == I2C_ERR_EXPIRED)
+                p->expired++;
+
+        if (rc != 0 || memcmp(w, r, 4) != 0)
+            p->bad++;
+    }
+    return 0;
+}
+
+
+static void testStuckSda()
+{
+    I2CFixture f(0x50);
+    StuckSlave stuck(TEST_SCL, TEST_SDA);
+    SIM_I2C_STATS st;
+    uint8_t w[4] = { 0x5A, 0xA5, 0x0F, 0xF0 }, r[4] = { 0 };
+    uint32_t map[I2C_SCAN_WORDS];
+
+#ifdef I2C_DRIVER_STATS
+    I2C_STATS ds;
+    CHECK(f.i2c.resetStats() == 0);
+#endif
+
+    // A whole byte of zeros left to send takes 8 pulses, then a STOP puts the
+    // bus back to idle and the transaction that found it goes through
+    stuck.hold(8);
+    f.bus.resetStats();
+    CHECK(f.i2c.tx(0x20, w, 4) == 0);
+    CHECK(stuck.pulses == 8);
+    f.bus.getStats(&st);
+    CHECK(st.stops == 2);
+    CHECK(f.i2c.rx(0x20, r, 4) == 0 && memcmp(w, r, 4) == 0);
+
+    // A slave three bits from the end needs only three
+    stuck.hold(3);
+    memset(r, 0, 4);
+    CHECK(f.i2c.rx(0x20, r, 4) == 0 && memcmp(w, r, 4) == 0);
+    CHECK(stuck.pulses == 3);
+
+    // and one that also holds the ACK slot is freed by the ninth, the most
+    // the recovery gives
+    stuck.hold(9);
+    memset(r, 0, 4);
+    CHECK(f.i2c.rx(0x20, r, 4) == 0 && memcmp(w, r, 4) == 0);
+    CHECK(stuck.pulses == 9);
+
+    // A scan frees the bus first too, rather than mistaking SDA for ACKs
+    stuck.hold(5);
+    CHECK(f.i2c.scan(map) == 1 && map[0x50 >> 5] == 1u << (0x50 & 31));
+    CHECK(stuck.pulses == 5);
+
+#ifdef I2C_DRIVER_STATS
+    CHECK(f.i2c.getStats(&ds) == 0);
+    CHECK(ds.recoveries == 4);
+#endif
+}
+
+
+static void testWaitLatency()
+{
+    I2CFixture f(0x50);
+    static const I2C_WAIT modes[2] = { I2C_WAIT_SPIN, I2C_WAIT_BACKOFF };
+    uint8_t r[32];
+    I2C_WAIT_LATENCY lat;
+
+    // Each strategy notices a finished transfer and says how late it was,
+    // within a bound far above any strategy's poll interval
+    for (int m = 0; m < 2; m++)
+    {
+        f.i2c.setWaitStrategy(modes[m]);
+        f.i2c.resetWaitLatency();
+        for (int i = 0; i < 8; i++)
+            CHECK(f.i2c.wait(f.i2c.rxAsync(0x00, r, 32)) == 0);
+
+        f.i2c.getWaitLatency(&lat);
+        CHECK(lat.count >= 1 && lat.count <= 8);
+        CHECK(lat.max > 0 && lat.max < CLKFREQ / 100);
+        CHECK(lat.last <= lat.max && lat.total >= lat.max);
+        CHECK(lat.total <= lat.max * lat.count);
+
+        f.i2c.resetWaitLatency();
+        f.i2c.getWaitLatency(&lat);
+        CHECK(lat.last == 0 && lat.max == 0 && lat.total == 0 && lat.count == 0);
+    }
+}
+
+
+static void testContention()
+{
+    I2CFixture f(0x50);
+
+    // Two producers posting through their own proxies at the same time
+    I2C a(f.i2c), b(f.i2c);
+    a.openBus(0x50);
+    b.openBus(0x50);
+    CHECK(a.isReady() && b.isReady());
+
+    PRODUCER pa = { &a, 0x80, 0, 0 }, pb = { &b, 0xC0, 0, 0 };
+    pthread_t ta, tb;
+    pthread_create(&ta, 0, producer, &pa);
+    pthread_create(&tb, 0, producer, &pb);
+    pthread_join(ta, 0);
+    pthread_join(tb, 0);
+    CHECK(pa.bad == 0 && pb.bad == 0);
+
+    I2C_CONTENTION ca, cb;
+    a.getContention(&ca);
+    b.getContention(&cb);
+    CHECK(ca.acquires == 80u + pa.expired && cb.acquires == 80u + pb.expired);
+
+    // A failed handle whose slot has since been reused by a good transfer
+    // reports that, not the new status
+    uint8_t w[2] = { 1, 2 };
+    a.openBus(0x51);
+    int old = a.txAsync(0x10, w, 2);
+    for (int i = 0; i < I2C_RING_SIZE; i++)
+        b.wait(b.txAsync(0x10, w, 2));
+    CHECK(a.wait(old) < 0);
+    CHECK(a.getStatus() == I2C_ERR_EXPIRED);
+    CHECK(b.getStatus() == I2C_OK);
+}
+
+
+static void testMultiBus()
+{
+    // Same device address on two pin pairs, one driver cog
+    SimI2CBus bus0(TEST_SCL, TEST_SDA), bus1(TEST_SCL - 2, TEST_SDA - 2);
+    SimI2CRegisterSlave dev0(0x50, 256, 1), dev1(0x50, 256, 1);
+    bus0.attach(&dev0);
+    bus1.attach(&dev1);
+
+    I2CMultiBus drv;
+    CHECK(drv.getCog() >= 0);
+
+    I2C x(drv, TEST_SCL, TEST_SDA, 400000);
+    {
+        I2C y(drv, TEST_SCL - 2, TEST_SDA - 2, 100000);
+        x.setWaitStrategy(I2C_WAIT_YIELD);
+        y.setWaitStrategy(I2C_WAIT_YIELD);
+        x.openBus(0x50);
+        y.openBus(0x50);
+        CHECK(x.isReady() && y.isReady());
+        CHECK(x.getCog() == drv.getCog() && y.getCog() == drv.getCog());
+        CHECK(drv.getBusCount() == 2);
+
+        uint8_t wx[3] = { 0x11, 0x22, 0x33 }, wy[3] = { 0xAA, 0xBB, 0xCC };
+        uint8_t rx[3] = { 0 }, ry[3] = { 0 };
+        int hx = x.txAsync(0x30, wx, 3);
+        int hy = y.txAsync(0x30, wy, 3);
+        CHECK(x.wait(hx) == 0 && y.wait(hy) == 0);
+        CHECK(dev0.regs[0x30] == 0x11 && dev1.regs[0x30] == 0xAA);
+        CHECK(x.rx(0x30, rx, 3) == 0 && y.rx(0x30, ry, 3) == 0);
+        CHECK(memcmp(wx, rx, 3) == 0 && memcmp(wy, ry, 3) == 0);
+    }
+
+    // The remaining bus carries on alone
+    CHECK(drv.getBusCount() == 1);
+    CHECK((uint8_t)x.rxByte(0x32) == 0x33);
+}
+
+
+// Queue four writes on [x] and one on [y] behind a slow first write on [x],
+// and wait for them all
+static int runQueued(I2C& x, I2C& y, SimI2CBus& bus0, StampSlave& dev0)
+{
+    uint8_t w[2] = { 0x12, 0x34 };
+    SIM_I2C_STATS st;
+    int h[5];
+
+    // Every byte of the first write is stretched for 20ms, short of the cog's
+    // stretch timeout.  The rest are queued once the cog is held in it.
+    bus0.resetStats();
+    dev0.stretch = CLKFREQ / 50;
+    h[0] = x.txAsync(0x10, w, 2);
+    uint32_t start = CNT;
+    do
+        bus0.getStats(&st);
+    while (st.stretches == 0 && CNT - start < CLKFREQ / 10);
+
+    h[1] = y.txAsync(0x10, w, 2);
+    for (int i = 2; i < 5; i++)
+        h[i] = x.txAsync(0x10 + 2 * i, w, 2);
+    dev0.stretch = 0;
+
+    int rc = y.wait(h[1]);
+    for (int i = 0; i < 5; i++)
+        if (i != 1)
+            rc |= x.wait(h[i]);
+    return rc;
+}
+
+
+static void testMultiPriority()
+{
+    int clock = 0;
+    SimI2CBus bus0(TEST_SCL, TEST_SDA), bus1(TEST_SCL - 2, TEST_SDA - 2);
+    StampSlave dev0(0x50, &clock), dev1(0x50, &clock);
+    bus0.attach(&dev0);
+    bus1.attach(&dev1);
+
+    // With priority the first bus drains its whole queue before the second
+    // gets a turn, where round-robin gives it the next one
+    for (int priority = 1; priority >= 0; priority--)
+    {
+        I2CMultiBus drv(priority);
+        I2C x(drv, TEST_SCL, TEST_SDA, 400000), y(drv, TEST_SCL - 2, TEST_SDA - 2, 400000);
+        x.setWaitStrategy(I2C_WAIT_YIELD);
+        y.setWaitStrategy(I2C_WAIT_YIELD);
+        x.openBus(0x50);
+        y.openBus(0x50);
+        dev0.n = dev1.n = 0;
+
+        CHECK(runQueued(x, y, bus0, dev0) == 0);
+        CHECK(dev0.n == 4 && dev1.n == 1);
+        if (priority)
+            CHECK(dev0.stamps[3] < dev1.stamps[0]);
+        else
+            CHECK(dev0.stamps[0] < dev1.stamps[0] && dev1.stamps[0] < dev0.stamps[1]);
+    }
+}
+
+
+static void testEeprom()
+{
+    SimI2CBus bus(TEST_SCL, TEST_SDA);
+    SimI2CEepromSlave ee(0x50, 32768, 2, 64, 400000);
+    SimI2CEepromSlave small(0x54, 256, 1, 16, 400000), small1(0x55, 256, 1, 16, 400000);
+    SimI2CEepromSlave fram(0x57, 8192, 2, 8192, 0);
+    bus.attach(&ee);
+    bus.attach(&small);
+    bus.attach(&small1);
+    bus.attach(&fram);
+
+    I2C i2c(TEST_SCL, TEST_SDA, 400000);
+    i2c.setWaitStrategy(I2C_WAIT_YIELD);
+    I2CEeprom e(i2c, 0x50, 32768, 64, 2), s(i2c, 0x54, 512, 16, 1), f(i2c, 0x57, 8192, 0, 2);
+    CHECK(e.isReady() && s.isReady() && f.isReady());
+
+    static uint8_t w[3000], r[3000];
+    for (int i = 0; i < 3000; i++)
+        w[i] = i * 13 + 5;
+
+    // Unaligned write across many pages, then read back
+    CHECK(e.write(100, w, 3000) == 0);
+    CHECK(e.read(100, r, 3000) == 0);
+    CHECK(memcmp(w, r, 3000) == 0);
+
+    // 1 address byte parts spill the high address bits into the device address
+    memset(r, 0, 100);
+    CHECK(s.write(200, w, 100) == 0);
+    CHECK(s.read(200, r, 100) == 0);
+    CHECK(memcmp(w, r, 100) == 0);
+    CHECK(small.writeCycles > 0 && small1.writeCycles > 0);
+
+    memset(r, 0, 500);
+    CHECK(f.writeAsync(10, w, 500) >= 0);
+    CHECK(f.sync() == 0);
+    CHECK(f.read(10, r, 500) == 0);
+    CHECK(memcmp(w, r, 500) == 0);
+
+    memset(r, 0, 100);
+    CHECK(s.writeAsync(200, w + 7, 100) >= 0);
+    CHECK(s.sync() == 0);
+    CHECK(s.read(200, r, 100) == 0);
+    CHECK(memcmp(w + 7, r, 100) == 0);
+
+    CHECK(e.read(32760, r, 16) < 0);
+
+    I2CEeprom bad(i2c, 0x50, 32768, 64, 4);
+    CHECK(!bad.isReady());
+    CHECK(bad.read(0, r, 4) < 0);
+
+    I2CEeprom gone(i2c, 0x52, 32768, 64, 2);
+    CHECK(gone.write(0, w, 200) < 0);
+}
+
+
+static void testRegCache()
+{
+    I2CFixture f(0x40, 64);
+    I2CRegCache c(f.i2c, 0x40, 64);
+
+    for (int i = 0; i < 8; i++)
+        CHECK(c.write(i, i + 1) == 0);
+    CHECK(c.write(20, 0x77) == 0);
+    CHECK(c.isDirty());
+    CHECK(c.flush() == 0);
+    CHECK(!c.isDirty());
+    CHECK(f.dev.regs[0] == 1 && f.dev.regs[7] == 8 && f.dev.regs[20] == 0x77);
+
+    // Adjacent dirty registers go out as one START to STOP burst
+    uint8_t v[6] = { 0x61, 0x62, 0x63, 0x64, 0x65, 0x66 };
+    uint8_t r[6] = { 0 };
+    SIM_I2C_STATS st;
+    c.setVolatile(40, 8, 0);
+    CHECK(c.write(40, v, 6) == 0);
+    f.bus.resetStats();
+    CHECK(c.flush() == 0);
+    f.bus.getStats(&st);
+    CHECK(st.starts == 1 && st.stops == 1 && st.bytes == 2 + 6);
+    CHECK(memcmp(&f.dev.regs[40], v, 6) == 0);
+
+    // Rewriting what a non-volatile register holds sends nothing, and reading
+    // it is answered from the copy even after the device changed behind it
+    f.bus.resetStats();
+    CHECK(c.write(40, v, 6) == 0);
+    CHECK(!c.isDirty());
+    CHECK(c.flush() == 0);
+    f.dev.regs[41] = 0xEE;
+    CHECK(c.read(40, r, 6) == 0);
+    CHECK(memcmp(r, v, 6) == 0);
+    f.bus.getStats(&st);
+    CHECK(st.starts == 0 && st.stops == 0 && st.bytes == 0);
+
+    // A non-volatile register nobody has touched is read once, then cached
+    f.dev.regs[46] = 0x5C;
+    CHECK(c.read(46, r, 1) == 0 && r[0] == 0x5C);
+    f.bus.getStats(&st);
+    CHECK(st.stops == 1);
+    CHECK(c.read(46, r, 1) == 0 && r[0] == 0x5C);
+    f.bus.getStats(&st);
+    CHECK(st.stops == 1);
+
+    // Volatile registers always go to the device, same value or not
+    c.setVolatile(41, 1, 1);
+    f.bus.resetStats();
+    CHECK(c.read(41, r, 1) == 0 && r[0] == 0xEE);
+    CHECK(c.write(41, 0xEE) == 0);
+    CHECK(c.isDirty());
+    CHECK(c.flush() == 0);
+    f.bus.getStats(&st);
+    CHECK(st.stops == 2);
+
+    c.setMaxBurst(2);
+    for (int i = 30; i < 35; i++)
+        c.write(i, i);
+    CHECK(c.flush() == 0);
+    CHECK(f.dev.regs[30] == 30 && f.dev.regs[34] == 34);
+
+    // A device that does not answer keeps its registers dirty
+    I2CRegCache gone(f.i2c, 0x41, 16);
+    gone.write(3, 9);
+    CHECK(gone.flush() < 0);
+    CHECK(gone.isDirty());
+}
+
+
+static void testRegMap()
+{
+    I2CFixture f(0x1D, 64);
+    I2CRegDevice accel(f.i2c, 0x1D), gone(f.i2c, 0x1E);
+    CHECK(accel.isReady());
+
+    typedef I2CReg<0x20, 1, uint8_t>                                CTRL1;
+    typedef I2CReg<0x28, 1, int16_t, I2C_REG_LSB_FIRST>             OFS_X;
+    typedef I2CReg<0x30, 1, uint32_t>                               TIME;
+    typedef I2CReg<0x38, 1, int16_t, I2C_REG_MSB_FIRST, I2C_REG_RO> OUT_X;
+
+    // Each register goes out at its width and order and reads back the same
+    uint8_t c = 0;
+    CHECK(accel.write<CTRL1>(0x57) == 0);
+    CHECK(f.dev.regs[0x20] == 0x57 && f.dev.regs[0x21] == 0);
+    CHECK(accel.read<CTRL1>(c) == 0 && c == 0x57);
+
+    int16_t x = 0;
+    CHECK(accel.write<OFS_X>(-300) == 0);
+    CHECK(f.dev.regs[0x28] == 0xD4 && f.dev.regs[0x29] == 0xFE);
+    CHECK(accel.read<OFS_X>(x) == 0 && x == -300);
+
+    uint32_t t = 0;
+    CHECK(accel.write<TIME>(0xA1B2C3D4) == 0);
+    CHECK(f.dev.regs[0x30] == 0xA1 && f.dev.regs[0x33] == 0xD4);
+    CHECK(accel.read<TIME>(t) == 0 && t == 0xA1B2C3D4);
+
+    f.dev.regs[0x38] = 0x80;
+    f.dev.regs[0x39] = 0x02;
+    CHECK(accel.read<OUT_X>(x) == 0 && x == -32766);
+
+    // The proxy leaves the bus handle's own device alone
+    f.i2c.openBus(0x1E);
+    CHECK(accel.read<CTRL1>(c) == 0 && c == 0x57);
+    CHECK(gone.write<CTRL1>(1) < 0);
+    CHECK(gone.read<CTRL1>(c) < 0);
+}
+
+
+/* Wait up to 100ms for a polling job to move past sample [seq] */
+static int waitPoll(I2C& i2c, int job, int seq, uint8_t* buf)
+{
+    uint32_t start = CNT;
+    int now;
+
+    while ((now = i2c.readPoll(job, buf)) == seq && CNT - start < CLKFREQ / 10)
+        usleep(100);
+    return now;
+}
+
+
+static void testPoll()
+{
+    I2CFixture f(0x48, 64);
+    f.dev.regs[0x10] = 0x12;
+    f.dev.regs[0x11] = 0x34;
+
+    uint8_t b[2] = { 0 };
+
+    CHECK(f.i2c.addPoll(0x48, 0x10, 0, 1000) < 0);
+    CHECK(f.i2c.addPoll(0x48, 0x10, I2C_POLL_BYTES + 1, 1000) < 0);
+    CHECK(f.i2c.readPoll(I2C_POLL_MAX, b) < 0);
+
+    // Periods past 2^31 ticks would look overdue to the cog's signed compare
+    uint32_t maxUs = 0x80000000u / (CLKFREQ / 1000000);
+    CHECK(f.i2c.addPoll(0x48, 0x10, 2, maxUs + 1) < 0);
+    CHECK(f.i2c.addPoll(0x48, 0x10, 2, 0xFFFFFFFF) < 0);
+    CHECK(f.i2c.addDrdyPoll(0x48, 0x10, 2, TEST_CS, 1, maxUs + 1) < 0);
+    int slow = f.i2c.addPoll(0x48, 0x10, 2, maxUs);
+    CHECK(slow >= 0);
+    f.i2c.removePoll(slow);
+
+    // A 1ms job runs on its own while the bus has no commands
+    int job = f.i2c.addPoll(0x48, 0x10, 2, 1000);
+    CHECK(job >= 0);
+    int seq = waitPoll(f.i2c, job, 0, b);
+    CHECK(seq > 0);
+    CHECK(b[0] == 0x12 && b[1] == 0x34);
+    CHECK(f.i2c.getPollStatus(job) == I2C_OK);
+
+    // Keeps to its period, neither stalling nor running ahead
+    f.bus.resetStats();
+    uint32_t start = CNT;
+    seq = f.i2c.readPoll(job, b);
+    waitUs(20000);
+    int ran = f.i2c.readPoll(job, b) - seq;
+    uint32_t ms = (CNT - start) / (CLKFREQ / 1000);
+    SIM_I2C_STATS st;
+    f.bus.getStats(&st);
+    CHECK(ran >= 5 && ran <= (int)ms + 1);
+    CHECK(st.stops >= (uint32_t)ran);
+
+    // A new value in the device shows up by the second sample, the first may
+    // have been read before the change
+    f.dev.regs[0x10] = 0x56;
+    f.dev.regs[0x11] = 0x78;
+    seq = waitPoll(f.i2c, job, f.i2c.readPoll(job, b), b);
+    seq = waitPoll(f.i2c, job, seq, b);
+    CHECK(b[0] == 0x56 && b[1] == 0x78);
+
+    // Commands still go through between samples
+    uint8_t w = 0x9A, r = 0;
+    CHECK(f.i2c.tx(0x20, &w, 1) == 0);
+    CHECK(f.i2c.rx(0x20, &r, 1) == 0 && r == 0x9A);
+
+    // A removed job stops after any read already under way
+    f.i2c.removePoll(job);
+    CHECK(f.i2c.rx(0x20, &r, 1) == 0);
+    seq = f.i2c.readPoll(job, b);
+    waitUs(10000);
+    CHECK(f.i2c.readPoll(job, b) == seq);
+}
+
+
+static void testDrdyPoll()
+{
+    I2CFixture f(0x48, 64);
+    DrdyPin drdy(TEST_CS);
+
+    uint8_t b[2] = { 0 };
+    SIM_I2C_STATS st;
+
+    // Nothing is read while the pin stays inactive
+    int job = f.i2c.addDrdyPoll(0x48, 0x10, 2, TEST_CS, 1, 5000000);
+    CHECK(job >= 0);
+    f.bus.resetStats();
+    waitUs(10000);
+    f.bus.getStats(&st);
+    CHECK(f.i2c.readPoll(job, b) == 0 && st.starts == 0);
+
+    // Each rising edge reads once, holding the pin active does not read again
+    for (int i = 1; i <= 3; i++)
+    {
+        f.dev.regs[0x10] = i;
+        drdy.drive(1);
+        CHECK(waitPoll(f.i2c, job, i - 1, b) == i);
+        CHECK(b[0] == i);
+        waitUs(5000);
+        drdy.drive(0);
+        waitUs(2000);
+        CHECK(f.i2c.readPoll(job, b) == i);
+    }
+    f.bus.getStats(&st);
+    CHECK(st.stops == 3);
+
+    // Active low, and a pin held active past the stuck time is read again.  A
+    // command through the cog fences off any pass still using the old job.
+    f.i2c.removePoll(job);
+    CHECK(f.i2c.rx(0x10, b, 1) == 0);
+    drdy.level = 1;
+    job = f.i2c.addDrdyPoll(0x48, 0x10, 2, TEST_CS, 0, 5000);
+    CHECK(job >= 0);
+    waitUs(10000);
+    CHECK(f.i2c.readPoll(job, b) == 0);
+    drdy.drive(0);
+    CHECK(waitPoll(f.i2c, job, 0, b) == 1);
+    CHECK(waitPoll(f.i2c, job, 1, b) == 2);
+    f.i2c.removePoll(job);
+
+    CHECK(f.i2c.addDrdyPoll(0x48, 0x10, 2, 32) < 0);
+    job = f.i2c.addDrdyPoll(0x48, 0x10, 2, 31, 1);
+    CHECK(job >= 0);
+    f.i2c.removePoll(job);
+}
+
+
+static void testSPI()
+{
+    SimSPIBus bus(TEST_SCK, TEST_MOSI, TEST_MISO);
+    EchoSlave echo[4];
+    for (int m = 0; m < 4; m++)
+        bus.attach(&echo[m], TEST_CS + m, m);
+
+    for (int m = 0; m < 4; m++)
+    {
+        SPI spi(TEST_MOSI, TEST_MISO, TEST_SCK, TEST_CS + m, 1000000, m);
+        spi.setWaitStrategy(SPI_WAIT_YIELD);
+        CHECK(spi.openBus() == 0);
+        CHECK(spi.isReady());
+
+        uint8_t d[4] = { 0x12, 0x34, 0x56, 0x78 };
+        CHECK(spi.rwData(d, 4) == 0);
+        CHECK(d[0] == 0x5A && d[1] == 0xED && d[2] == 0xCB && d[3] == 0xA9);
+        CHECK(spi.rwWord(0xABCD) == 0x5A54);
+
+        CHECK(spi.setSpeed(CLKFREQ / (2 * SPI_MIN_HALF)) == 0);
+        CHECK(spi.setSpeed(CLKFREQ / (2 * SPI_MIN_HALF) + 1) < 0);
+    }
+
+    // Device handles share the cog, each with its own CS, mode and width
+    SPI spi(TEST_MOSI, TEST_MISO, TEST_SCK, TEST_CS, 1000000, 0);
+    spi.setWaitStrategy(SPI_WAIT_YIELD);
+    spi.openBus();
+    SPI wide(spi, TEST_CS + 3, 1000000, 3, 12);
+    CHECK(wide.openBus() == 0);
+    uint8_t x[4] = { 0x0A, 0xBC, 0x01, 0x23 };
+    CHECK(wide.rwData(x, 4) == 0);
+    CHECK(x[0] == 0x05 && x[1] == 0xA5 && x[2] == 0x04 && x[3] == 0x3E);
+
+    int h = -1;
+    uint8_t y[6][2];
+    for (int i = 0; i < 6; i++)
+    {
+        y[i][0] = i;
+        y[i][1] = 0x80 | i;
+        h = (i & 1) ? wide.transferAsync(y[i], 1) : spi.transferAsync(y[i], 2);
+    }
+    CHECK(h >= 0);
+    CHECK(spi.wait(h) == 0);
+    CHECK(y[4][0] == 0x5A && y[4][1] == (uint8_t)~4);
+}
+
+
+typedef struct SPI_PRODUCER
+{
+    SPI*        dev;            // Device handle for this producer
+    int         bad;            // Transfers that failed or came back wrong
+    int         expired;        // Handles lost to slot reuse and run again
+} SPI_PRODUCER;
+
+
+static void* spiProducer(void* arg)
+{
+    SPI_PRODUCER *p = (SPI_PRODUCER *)arg;
+
+    for (int i = 0; i < 40; i++)
+    {
+        uint8_t d[4] = { (uint8_t)i, (uint8_t)~i, 0x33, 0xC4 };
+        int rc;
+
+        // As with I2C, a handle left behind by a whole ring of the other
+        // producer's commands is reported expired and the transfer run again
+        while ((rc = p->dev->wait(p->dev->transferAsync(d, 4))) != 0 &&
+               p->dev->getStatus() == SPI_ERR_EXPIRED)
+        {
+            p->expired++;
+            d[0] = i; d[1] = ~i; d[2] = 0x33; d[3] = 0xC4;
+        }
+
+        if (rc != 0 || d[0] != 0x5A || d[1] != (uint8_t)~i || d[2] != (uint8_t)i || d[3] != 0xCC)
+            p->bad++;
+    }
+    return 0;
+}
+
+
+static void testSPIContention()
+{
+    SimSPIBus bus(TEST_SCK, TEST_MOSI, TEST_MISO);
+    EchoSlave echo[2];
+    bus.attach(&echo[0], TEST_CS, 0);
+    bus.attach(&echo[1], TEST_CS + 1, 0);
+
+    SPI spi(TEST_MOSI, TEST_MISO, TEST_SCK, TEST_CS, 1000000, 0);
+    spi.setWaitStrategy(SPI_WAIT_YIELD);
+    spi.openBus();
+    SPI a(spi, TEST_CS, 1000000, 0), b(spi, TEST_CS + 1, 1000000, 0);
+    a.openBus();
+    b.openBus();
+
+    // Two producers posting through their own device handles at the same time
+    SPI_PRODUCER pa = { &a, 0, 0 }, pb = { &b, 0, 0 };
+    pthread_t ta, tb;
+    pthread_create(&ta, 0, spiProducer, &pa);
+    pthread_create(&tb, 0, spiProducer, &pb);
+    pthread_join(ta, 0);
+    pthread_join(tb, 0);
+    CHECK(pa.bad == 0 && pb.bad == 0);
+
+    // A handle whose slot has since been reused by another device's transfer
+    // reports that, not the other transfer's status
+    uint8_t w[2] = { 1, 2 }, x[2];
+    int old = a.transferAsync(w, 2);
+    for (int i = 0; i < SPI_RING_SIZE; i++)
+        b.wait(b.transferAsync(x, 2));
+    CHECK(a.wait(old) < 0);
+    CHECK(a.getStatus() == SPI_ERR_EXPIRED);
+    CHECK(b.getStatus() == SPI_OK);
+    CHECK(a.wait(a.transferAsync(w, 2)) == 0 && a.getStatus() == SPI_OK);
+}
+
+
+static void testSPISpeed()
+{
+    SimSPIBus bus(TEST_SCK, TEST_MOSI, TEST_MISO);
+    EchoSlave echo[4];
+    for (int m = 0; m < 4; m++)
+        bus.attach(&echo[m], TEST_CS + m, m);
+    SIM_SPI_STATS st;
+
+    // The top rate in every mode, 1MHz at 80MHz, never faster than that.  A
+    // word's last edge is at least (2 * bits - 1) half cycles after its start.
+    for (int m = 0; m < 4; m++)
+    {
+        SPI spi(TEST_MOSI, TEST_MISO, TEST_SCK, TEST_CS + m, CLKFREQ / (2 * SPI_MIN_HALF), m);
+        spi.setWaitStrategy(SPI_WAIT_YIELD);
+        CHECK(spi.openBus() == 0);
+
+        bus.resetStats();
+        uint8_t d[4] = { 0x12, 0x34, 0x56, 0x78 };
+        CHECK(spi.rwData(d, 4) == 0);
+        CHECK(d[0] == 0x5A && d[1] == 0xED && d[2] == 0xCB && d[3] == 0xA9);
+        bus.getStats(&st);
+        CHECK(st.edges == 64 && st.ticks >= 4 * 15 * SPI_MIN_HALF);
+    }
+
+    // Slower rates stretch every half cycle to match
+    SPI mid(TEST_MOSI, TEST_MISO, TEST_SCK, TEST_CS, CLKFREQ / (4 * SPI_MIN_HALF), 0);
+    mid.setWaitStrategy(SPI_WAIT_YIELD);
+    mid.openBus();
+    bus.resetStats();
+    CHECK(mid.rwByte(0x81) == 0x5A);
+    bus.getStats(&st);
+    CHECK(st.edges == 16 && st.ticks >= 15 * 2 * SPI_MIN_HALF);
+    CHECK(mid.setSpeed(CLKFREQ / (2 * SPI_MIN_HALF) + 1) < 0);
+}
+
+
+static void testChain()
+{
+    // Command level, two L6470s in a chain
+    SimSPIL6470Slave a, b;
+    SimSPIChainSlave chain;
+    chain.add(&a);
+    chain.add(&b);
+    SimSPI sim(&chain, 3, 1000000, 3);
+    sim.openBus();
+    sim.setBPW(16);
+
+    SPIChain c(sim, 2, 4);
+    CHECK(c.isReady());
+    uint8_t c0[4] = { 0x40, 0, 0, 0x10 }, c1[4] = { 0x41, 0, 0, 0x20 };
+    uint8_t* moves[2] = { c0, c1 };
+    int moveLens[2] = { 4, 4 };
+    CHECK(c.exchange(moves, moveLens) == 0);
+    CHECK(sim.getBPW() == 16);
+
+    uint8_t g0[4] = { 0x20 | SIM_L6470_ABS_POS, 0, 0, 0 }, g1[3] = { 0x20 | SIM_L6470_KVAL_RUN, 0, 0 };
+    uint8_t* gets[2] = { g0, g1 };
+    int getLens[2] = { 4, 2 };
+    CHECK(c.exchange(gets, getLens) == 0);
+    CHECK(g0[1] == 0x3F && g0[2] == 0xFF && g0[3] == 0xF0);
+    CHECK(g1[1] == 0x29);
+
+    // SetParam on a register past STATUS is refused without taking arguments
+    SimSPIL6470Slave m;
+    SimSPI s(&m, 3, 1000000, 3);
+    s.openBus();
+    for (int op = SIM_L6470_REGS; op < 0x20; op++)
+        s.rwByte(op);
+    s.rwByte(0xD0);
+    uint16_t status = s.rwByte(0) << 8;
+    status |= s.rwByte(0);
+    CHECK(status & SIM_L6470_WRONG_CMD);
+    s.rwByte(0x20 | SIM_L6470_CONFIG);
+    uint16_t config = s.rwByte(0) << 8;
+    config |= s.rwByte(0);
+    CHECK(config == 0x2E88);
+
+    // Pin level, behind the driver cog
+    SimSPIBus bus(TEST_SCK, TEST_MOSI, TEST_MISO);
+    SimSPIL6470Slave pa, pb;
+    SimSPIChainSlave pins;
+    pins.add(&pa);
+    pins.add(&pb);
+    bus.attach(&pins, TEST_CS, 3);
+
+    SPI spi(TEST_MOSI, TEST_MISO, TEST_SCK, TEST_CS, 1000000, 3);
+    spi.setWaitStrategy(SPI_WAIT_YIELD);
+    spi.openBus();
+    SPIChain pc(spi, 2, 4);
+    uint8_t d[8] = { 0x41, 0, 1, 0, 0x40, 0, 2, 0 };
+    CHECK(pc.exchange(d, 4) == 0);
+    uint8_t q[8] = { 0x21, 0, 0, 0, 0x21, 0, 0, 0 };
+    CHECK(pc.exchange(q, 4) == 0);
+    CHECK(q[1] == 0x00 && q[2] == 0x01 && q[3] == 0x00);
+    CHECK(q[5] == 0x3F && q[6] == 0xFE && q[7] == 0x00);
+    CHECK(spi.getBPW() == 8);
+}
+
+
+static void testStream()
+{
+    SimSPIBus bus(TEST_SCK, TEST_MOSI, TEST_MISO);
+    PatternSlave sink;
+    bus.attach(&sink, TEST_CS, 0);
+
+    SPI spi(TEST_MOSI, TEST_MISO, TEST_SCK, TEST_CS, 1000000, 0);
+    spi.setWaitStrategy(SPI_WAIT_YIELD);
+    spi.openBus();
+
+    SPIStream st(spi, 256);
+    CHECK(st.start() == 0);
+    CHECK(st.isRunning());
+
+    uint8_t buf[300];
+    uint32_t k = 0;
+    int rc = 0;
+    for (int i = 0; i < 12; i++)
+    {
+        int len = 1 + (i * 37) % 300;
+        for (int j = 0; j < len; j++)
+            buf[j] = (uint8_t)(k++ * 7);
+        rc |= st.write(buf, len);
+    }
+    uint8_t* half = st.nextHalf();
+    for (int j = 0; j < 100; j++)
+        half[j] = (uint8_t)(k++ * 7);
+    rc |= st.commit(100);
+    CHECK(rc == 0);
+    CHECK(st.finish() == 0);
+    CHECK(sink.count == k && sink.bad == 0);
+
+    SPI_STREAM_STATS ss;
+    SIM_SPI_STATS bs;
+    st.getStats(&ss);
+    bus.getStats(&bs);
+    CHECK(ss.bytes == k);
+    CHECK(bs.selects == 1);
+
+    uint8_t after[2] = { 0, 7 };
+    CHECK(spi.rwData(after, 2) == 0);
+}
+
+
+// Hand [len] bytes from [k] on to the stream as one half
+static void streamHalf(SPIStream& st, uint8_t*& half, uint32_t& k, int len)
+{
+    half = st.nextHalf();
+    for (int j = 0; j < len; j++)
+        half[j] = (uint8_t)(k++ * 7);
+    st.commit(len);
+}
+
+
+// Wait up to 100ms of CNT for the stream's counters to reach [halves] and
+// [underruns]
+static void waitStream(SPIStream& st, uint32_t halves, uint32_t underruns)
+{
+    SPI_STREAM_STATS ss;
+    uint32_t start = CNT;
+    do
+        st.getStats(&ss);
+    while ((ss.halves < halves || ss.underruns < underruns) && CNT - start < CLKFREQ / 10 &&
+           (usleep(100), 1));
+}
+
+
+static void testStreamStarved()
+{
+    SimSPIBus bus(TEST_SCK, TEST_MOSI, TEST_MISO);
+    EchoSlave echo;
+    bus.attach(&echo, TEST_CS, 0);
+
+    // Slow enough that a half outlasts any host hiccup in the producer
+    SPI spi(TEST_MOSI, TEST_MISO, TEST_SCK, TEST_CS, 100000, 0);
+    spi.setWaitStrategy(SPI_WAIT_YIELD);
+    spi.openBus();
+
+    // The producer leaves the cog dry after each of the first two halves.  It
+    // pauses SCLK with CS still low, so the slave sees one unbroken transfer
+    // and every byte comes back as the inverse of the one before it.
+    SPIStream st(spi, 16);
+    SPI_STREAM_STATS ss;
+    uint8_t *a, *b, *c, *d, *e;
+    uint8_t ra[16], rb[16];
+    uint32_t k = 0;
+    CHECK(st.start() == 0);
+
+    streamHalf(st, a, k, 16);
+    waitStream(st, 1, 1);
+    memcpy(ra, a, 16);
+    streamHalf(st, b, k, 16);
+    waitStream(st, 2, 2);
+    memcpy(rb, b, 16);
+    st.getStats(&ss);
+    CHECK(ss.halves == 2 && ss.underruns == 2 && ss.stalls == 0);
+
+    // Then it runs ahead, and waits for the cog when both halves are its
+    streamHalf(st, c, k, 16);
+    streamHalf(st, d, k, 16);
+    streamHalf(st, e, k, 16);
+    CHECK(st.finish() == 0);
+    st.getStats(&ss);
+    CHECK(ss.halves == 5 && ss.bytes == 80 && ss.underruns >= 2 && ss.stalls == 1);
+    CHECK(c == a && d == b && e == a);
+
+    int bad = 0;
+    for (int j = 0; j < 16; j++)
+    {
+        if (ra[j] != (j ? (uint8_t)~(uint8_t)((j - 1) * 7) : 0x5A))
+            bad++;
+        if (rb[j] != (uint8_t)~(uint8_t)((15 + j) * 7))
+            bad++;
+        if (d[j] != (uint8_t)~(uint8_t)((47 + j) * 7) || e[j] != (uint8_t)~(uint8_t)((63 + j) * 7))
+            bad++;
+    }
+    CHECK(bad == 0);
+
+    SIM_SPI_STATS bs;
+    bus.getStats(&bs);
+    CHECK(echo.count == 80 && bs.selects == 1);
+}
+
+
+static void testFlash()
+{
+    SimSPIFlashSlave flash;
+    SimSPI fs(&flash, 0, 1000000, 0);
+    fs.openBus();
+
+    uint8_t id[4] = { 0x9F, 0, 0, 0 };
+    CHECK(fs.rwData(id, 4) == 0);
+    CHECK(((uint32_t)id[1] << 16 | id[2] << 8 | id[3]) == flash.jedec);
+
+    uint8_t we = 0x06;
+    uint8_t pp[24] = { 0x02, 0x00, 0x10, 0xF0 };
+    for (int i = 0; i < 20; i++)
+        pp[4 + i] = i;
+    fs.rwData(&we, 1);
+    fs.rwData(pp, 24);
+
+    uint8_t sr[2];
+    do
+    {
+        sr[0] = 0x05;
+        sr[1] = 0;
+        fs.rwData(sr, 2);
+    }
+    while (sr[1] & 1);
+
+    // Page programs wrap inside the 256 byte page
+    uint8_t rd[24] = { 0x03, 0x00, 0x10, 0xF0 };
+    CHECK(fs.rwData(rd, 24) == 0);
+    CHECK(rd[4] == 0x00 && rd[19] == 0x0F && rd[20] == 0xFF);
+    CHECK(flash.mem[0x1000] == 0x10 && flash.mem[0x1003] == 0x13);
+    CHECK(flash.programs == 1);
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "-v") == 0)
+        s_verbose = 1;
+
+    testI2C();
+    testBusFreq();
+    testBench();
+    testInventory();
+    testSeg();
+    testWords();
+    testRegBytes();
+    testI2CFaults();
+    testStuckSda();
+    testWaitLatency();
+    testContention();
+    testMultiBus();
+    testMultiPriority();
+    testEeprom();
+    testRegCache();
+    testRegMap();
+    testPoll();
+    testDrdyPoll();
+    testSPI();
+    testSPIContention();
+    testSPISpeed();
+    testChain();
+    testStream();
+    testStreamStarved();
+    testFlash();
+
+    printf("%d of %d checks failed\n", s_failed, s_checks);
+    return s_failed;
+}
+
+/*
+ Copyright (C) 2013 Kyle Crane
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of
+ this software and associated documentation files (the "Software"), to deal in
+ the Software without restriction, including without limitation the rights to
+ use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ of the Software, and to permit persons to whom the Software is furnished to do
+ so, subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */